@@ -0,0 +1,161 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class AsyncIO {
+  public:
+    /**
+     * @brief Sequencia contigua de blocos a transferir numa unica operacao
+     *
+     */
+    struct Run {
+        off_t pos;              // posicao em bytes na imagem
+        std::vector<iovec> iov; // buffers de cada bloco
+        bool write;             // true para gravar
+    };
+
+    virtual ~AsyncIO() = default;
+
+    /**
+     * @brief Cria o motor assincrono: io_uring se o kernel suportar, senao pool de threads
+     *
+     * @param fd descritor da imagem
+     * @param depth numero maximo de operacoes em voo
+     * @return std::unique_ptr<AsyncIO> motor criado
+     */
+    static std::unique_ptr<AsyncIO> create(int fd, unsigned depth = 64);
+
+    /**
+     * @brief Submete um lote de sequencias
+     *
+     * @param runs sequencias a transferir (buffers precisam viver ate o wait)
+     * @return uint64_t ticket do lote
+     */
+    virtual uint64_t submit(std::vector<Run>&& runs) = 0;
+
+    /**
+     * @brief Aguarda o termino de todas as sequencias do lote
+     *
+     * @param ticket lote retornado por submit
+     * @throw runtime_error se alguma operacao falhou
+     */
+    virtual void wait(uint64_t ticket) = 0;
+
+    /**
+     * @brief Nome do motor em uso
+     *
+     */
+    virtual const char* name() const = 0;
+
+  protected:
+    struct Batch {
+        std::vector<Run> runs; // sequencias do lote
+        size_t pending = 0;    // sequencias ainda em voo
+        int error = 0;         // primeiro errno recebido
+    };
+
+    /**
+     * @brief Conclui uma sequencia: completa leitura curta (fim da imagem) com zeros
+     *
+     * @param batch lote da sequencia
+     * @param run sequencia concluida
+     * @param result bytes transferidos ou -errno
+     */
+    static void complete(Batch* batch, const Run& run, ssize_t result);
+
+    uint64_t next_ticket = 1;
+};
+
+#if __has_include(<linux/io_uring.h>)
+/**
+ * @brief Motor io_uring usando as syscalls diretamente (sem liburing)
+ *
+ */
+class UringIO : public AsyncIO {
+  public:
+    /**
+     * @brief Construct a new Uring I O object
+     *
+     * @param fd descritor da imagem
+     * @param depth tamanho do anel de submissao
+     * @throw runtime_error se io_uring nao estiver disponivel
+     */
+    UringIO(int fd, unsigned depth);
+    ~UringIO();
+
+    uint64_t submit(std::vector<Run>&& runs) override;
+    void wait(uint64_t ticket) override;
+    const char* name() const override { return "io_uring"; }
+
+  private:
+    /**
+     * @brief Processa completions disponiveis, aguardando ao menos min_complete
+     *
+     * @param min_complete quantidade minima de completions a aguardar
+     */
+    void reap(unsigned min_complete);
+
+    int fd;
+    int ring = -1;
+    std::mutex mutex; // um anel para todas as threads: submit e wait se revezam
+    unsigned in_flight = 0;
+    unsigned depth;
+
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Batch>> batches;
+};
+#endif
+
+/**
+ * @brief Emulacao assincrona com pool de threads fazendo preadv/pwritev
+ *
+ */
+class PoolIO : public AsyncIO {
+  public:
+    /**
+     * @brief Construct a new Pool I O object
+     *
+     * @param fd descritor da imagem
+     * @param workers numero de threads
+     */
+    PoolIO(int fd, unsigned workers);
+    ~PoolIO();
+
+    uint64_t submit(std::vector<Run>&& runs) override;
+    void wait(uint64_t ticket) override;
+    const char* name() const override { return "thread pool"; }
+
+  private:
+    void worker();
+
+    int fd;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable done;
+    std::deque<std::pair<Batch*, const Run*>> queue;
+    std::unordered_map<uint64_t, std::unique_ptr<Batch>> batches;
+    std::vector<std::thread> threads;
+};
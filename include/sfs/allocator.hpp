@@ -0,0 +1,144 @@
+#pragma once
+#include "sfs/bitmap.hpp"
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Mapa de blocos livres dividido em fatias (shards), cada uma com seu lock
+ *
+ * A alocacao comeca na fatia do bloco preferido (goal) ou, sem goal, na fatia da CPU
+ * corrente, e so passa as seguintes quando ela esta cheia: alocacoes concorrentes em fatias
+ * diferentes nao disputam o mesmo lock. Fatias tem tamanho multiplo de 64 bits, as palavras
+ * de data()/assign() seguem o formato de um Bitmap unico.
+ */
+class Allocator {
+  public:
+    Allocator() = default;
+
+    /**
+     * @brief Redimensiona o mapa, todos os bits livres
+     *
+     * A fatia 0 cobre [0, offset + width), as seguintes width bits cada; a ultima vai ate o fim.
+     *
+     * @param bits quantidade de bits
+     * @param offset bits da fatia 0 alem de width (multiplo de 64)
+     * @param width bits por fatia (multiplo de 64)
+     * @param shards numero de fatias
+     */
+    void resize(size_t bits, size_t offset = 0, size_t width = 0, size_t shards = 1);
+
+    /**
+     * @brief Quantidade de bits do mapa
+     *
+     */
+    size_t size() const { return Bits; }
+
+    /**
+     * @brief Numero de fatias
+     *
+     */
+    size_t shards() const { return slices.size(); }
+
+    /**
+     * @brief Fatia que contem o bit
+     *
+     */
+    size_t shard(size_t bit) const;
+
+    /**
+     * @brief Bits livres da fatia
+     *
+     * @param index indice da fatia
+     */
+    size_t available(size_t index);
+
+    /**
+     * @brief Bit ocupado
+     *
+     * @param bit indice do bit
+     */
+    bool test(size_t bit);
+
+    /**
+     * @brief Marca bit como ocupado
+     *
+     * @param bit indice do bit
+     */
+    void set(size_t bit);
+
+    /**
+     * @brief Marca bit como livre
+     *
+     * @param bit indice do bit
+     */
+    void clear(size_t bit);
+
+    /**
+     * @brief Ocupa um bit livre do intervalo: o primeiro a partir de goal na fatia de goal, senao nas seguintes
+     *
+     * @param goal bit preferido (fora do intervalo: comeca na fatia da CPU corrente)
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @return size_t bit ocupado ou to se o intervalo esta cheio
+     */
+    size_t allocate(size_t goal, size_t from, size_t to);
+
+    /**
+     * @brief Ocupa uma sequencia livre: a partir de goal se livre, senao a primeira com count bits
+     *
+     * A busca comeca na fatia de goal (ou na da CPU corrente); sem sequencia completa em nenhuma
+     * fatia, ocupa a maior encontrada.
+     *
+     * @param goal bit preferido (fora do intervalo para nenhum)
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @param count tamanho desejado (sequencias nao atravessam fatias)
+     * @param got tamanho ocupado (0 se nenhum bit livre)
+     * @return size_t primeiro bit ocupado
+     */
+    size_t allocate_run(size_t goal, size_t from, size_t to, size_t count, size_t* got);
+
+    /**
+     * @brief Palavras de todas as fatias, em ordem, para gravacao em disco
+     *
+     */
+    std::vector<uint64_t> data();
+
+    /**
+     * @brief Carrega palavras gravadas a partir de data()
+     *
+     * @param data (bits + 63) / 64 palavras
+     * @param bits quantidade de bits
+     */
+    void assign(const uint64_t* data, size_t bits);
+
+    /**
+     * @brief Une (OR) os bits ocupados de um mapa do mesmo tamanho
+     *
+     * @param other mapa a unir
+     */
+    void merge(const Bitmap& other);
+
+  private:
+    struct Slice {
+        std::mutex lock; // protege map
+        Bitmap map;      // bits [first, first + map.size())
+        size_t first;    // primeiro bit da fatia
+    };
+
+    Slice& slice(size_t bit) { return *slices[shard(bit)]; }
+
+    /**
+     * @brief Fatia onde a busca comeca: a de goal se estiver no intervalo, senao a da CPU corrente
+     *
+     */
+    size_t home(size_t goal, size_t from, size_t to) const;
+
+    std::vector<std::unique_ptr<Slice>> slices;
+    size_t Bits = 0;  // Number of bits in use
+    size_t Offset = 0; // bits da fatia 0 alem de Width
+    size_t Width = 0;  // bits por fatia (multiplo de 64)
+};
@@ -0,0 +1,137 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Mapa de bits em palavras de 64 bits (bit ligado = bloco ocupado)
+ *
+ * Um segundo nivel (summary) marca as palavras que ainda tem bit livre, a busca pula
+ * 64 palavras cheias por vez. hint e o limite inferior do primeiro bit livre.
+ */
+class Bitmap {
+  public:
+    Bitmap() = default;
+
+    /**
+     * @brief Redimensiona o mapa, todos os bits livres
+     *
+     * @param bits quantidade de bits
+     */
+    void resize(size_t bits);
+
+    /**
+     * @brief Quantidade de bits do mapa
+     *
+     */
+    size_t size() const { return Bits; }
+
+    /**
+     * @brief Bit ocupado
+     *
+     * @param bit indice do bit
+     */
+    bool test(size_t bit) const { return (words[bit / 64] >> (bit % 64)) & 1; }
+
+    /**
+     * @brief Marca bit como ocupado
+     *
+     * @param bit indice do bit
+     */
+    void set(size_t bit);
+
+    /**
+     * @brief Marca bit como livre
+     *
+     * @param bit indice do bit
+     */
+    void clear(size_t bit);
+
+    /**
+     * @brief Primeiro bit livre do intervalo
+     *
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @return size_t bit encontrado ou to se nenhum
+     */
+    size_t find_free(size_t from, size_t to) const;
+
+    /**
+     * @brief Primeiro bit ocupado do intervalo
+     *
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @return size_t bit encontrado ou to se nenhum
+     */
+    size_t find_used(size_t from, size_t to) const;
+
+    /**
+     * @brief Primeira sequencia livre com count bits, senao a maior do intervalo
+     *
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @param count tamanho desejado
+     * @param length tamanho encontrado (no maximo count, 0 se nenhum bit livre)
+     * @return size_t primeiro bit da sequencia
+     */
+    size_t find_run(size_t from, size_t to, size_t count, size_t* length) const;
+
+    /**
+     * @brief Quantidade de bits livres no intervalo
+     *
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     */
+    size_t count_free(size_t from, size_t to) const;
+
+    /**
+     * @brief Ocupa o primeiro bit livre do intervalo, partindo do hint
+     *
+     * @param from primeiro bit do intervalo
+     * @param to fim do intervalo (exclusivo)
+     * @return size_t bit ocupado ou to se o intervalo esta cheio
+     */
+    size_t allocate(size_t from, size_t to);
+
+    /**
+     * @brief Palavras do mapa, para gravacao em disco
+     *
+     */
+    const std::vector<uint64_t>& data() const { return words; }
+
+    /**
+     * @brief Carrega palavras gravadas a partir de data()
+     *
+     * @param data (bits + 63) / 64 palavras
+     * @param bits quantidade de bits
+     */
+    void assign(const uint64_t* data, size_t bits);
+
+    /**
+     * @brief Une (OR) os bits ocupados de outro mapa do mesmo tamanho
+     *
+     * @param other mapa a unir
+     */
+    void merge(const Bitmap& other) { merge(other.words.data()); }
+
+    /**
+     * @brief Une (OR) palavras no formato de data()
+     *
+     * @param data words.size() palavras
+     */
+    void merge(const uint64_t* data);
+
+  private:
+    std::vector<uint64_t> words;   // bit ligado = ocupado
+    std::vector<uint64_t> summary; // bit ligado = palavra com bit livre
+    size_t Bits = 0;               // Number of bits in use
+    size_t hint = 0;               // nenhum bit livre abaixo deste
+
+    /**
+     * @brief Proxima palavra com bit livre a partir de word (summary)
+     *
+     * @param word primeira palavra candidata
+     * @return size_t indice da palavra ou words.size() se nenhuma
+     */
+    size_t next_free_word(size_t word) const;
+};
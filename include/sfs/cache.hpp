@@ -0,0 +1,246 @@
+#pragma once
+#include "sfs/disk.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Cache de blocos write-back compartilhado entre threads
+ *
+ * Frames sao protegidos por um unico lock, solto durante a leitura de um bloco ausente (o frame
+ * fica reservado como loading); sem frames (passthrough) as chamadas seguem direto ao disco, sem
+ * lock (exceto com blocos retidos para o journal).
+ */
+class BlockCache {
+  public:
+    /**
+     * @brief Politica de substituicao dos frames
+     *
+     */
+    enum class Policy { LRU, CLOCK };
+
+    /**
+     * @brief Construct a new Block Cache object
+     *
+     * @param capacity numero maximo de blocos em memoria (0 desliga o cache)
+     * @param policy politica de substituicao
+     */
+    BlockCache(size_t capacity = 64, Policy policy = Policy::LRU);
+    ~BlockCache();
+
+    /**
+     * @brief Associa o cache ao disco e aloca os frames
+     *
+     * @param disk disco a ser cacheado
+     */
+    void attach(Disk* disk);
+
+    /**
+     * @brief Grava blocos sujos e desassocia o disco
+     *
+     */
+    void detach();
+
+    /**
+     * @brief Read block through the cache
+     *
+     * @param blocknum Block to read from
+     * @param data Buffer to read into
+     */
+    void read(int blocknum, char* data);
+
+    /**
+     * @brief Write block into the cache (write-back, marca frame como sujo)
+     *
+     * @param blocknum Block to write to
+     * @param data Buffer to write from
+     */
+    void write(int blocknum, char* data);
+
+    /**
+     * @brief Le um lote de blocos; os ausentes vao ao disco em chamadas vetorizadas
+     *
+     * Blocos lidos do disco nao entram no cache (dados em massa nao expulsam metadados)
+     *
+     * @param requests blocos e buffers, na ordem
+     */
+    void readv(const std::vector<Disk::Request>& requests);
+
+    /**
+     * @brief Inicia a leitura de um lote: ausentes sao submetidos ao disco sem esperar
+     *
+     * Os buffers precisam continuar validos ate wait().
+     *
+     * @param requests blocos e buffers, na ordem
+     * @return uint64_t ticket para wait()
+     */
+    uint64_t read_async(const std::vector<Disk::Request>& requests);
+
+    /**
+     * @brief Aguarda leitura iniciada por read_async()
+     *
+     * @param ticket valor retornado por read_async()
+     */
+    void wait(uint64_t ticket) { disk->wait(ticket); }
+
+    /**
+     * @brief Leitura antecipada: blocos ausentes sao carregados em frames sem esperar
+     *
+     * Ocupa no maximo metade dos frames; um frame antecipado e liberado depois de lido por
+     * read_async (dados em massa nao expulsam metadados). Sem frames vira dica ao disco.
+     *
+     * @param blocknums blocos a carregar, na ordem
+     */
+    void prefetch(const std::vector<int>& blocknums);
+
+    /**
+     * @brief Grava um lote de blocos direto no disco (write-through), atualizando copias em cache
+     *
+     * @param requests blocos e buffers, na ordem
+     */
+    void writev(const std::vector<Disk::Request>& requests);
+
+    /**
+     * @brief Grava no disco todos os blocos sujos
+     *
+     */
+    void flush();
+
+    /**
+     * @brief flush() seguido de sync do disco
+     *
+     */
+    void sync();
+
+    /**
+     * @brief Retem as escritas de write() ate release(): nao chegam ao disco antes do commit do journal
+     *
+     * Leituras veem os blocos retidos; writev de um bloco retido descarta a copia retida (bloco
+     * reusado como dado).
+     *
+     * @param on liga ou desliga a retencao
+     */
+    void retain(bool on);
+
+    /**
+     * @brief Quantidade de blocos retidos
+     *
+     */
+    size_t retained();
+
+    /**
+     * @brief Bloco esta retido
+     *
+     * @param blocknum numero do bloco
+     */
+    bool retains(int blocknum);
+
+    /**
+     * @brief Blocos retidos em ordem de numero (buffers validos ate release)
+     *
+     */
+    std::vector<Disk::Request> retained_blocks();
+
+    /**
+     * @brief Solta os blocos retidos: viram frames sujos (write-back) ou, sem frames, sao gravados
+     *
+     */
+    void release();
+
+    size_t hits() const { return Hits; }
+    size_t misses() const { return Misses; }
+    size_t prefetches() const { return Prefetches; }
+
+  private:
+    struct Frame {
+        int blocknum;                    // bloco em cache (-1 livre)
+        bool dirty;                      // precisa ser gravado
+        bool ref;                        // bit de referencia (CLOCK)
+        bool ahead;                      // carregado por prefetch e ainda nao lido
+        bool loading;                    // read() lendo o bloco sem o lock (nao pode ser vitima)
+        uint64_t ticket;                 // leitura antecipada em voo (0 carregado)
+        std::list<size_t>::iterator lru; // posicao na lista LRU
+    };
+
+    /**
+     * @brief Procura bloco no cache, esperando se outra thread o esta lendo
+     *
+     * @param blocknum bloco procurado
+     * @param guard lock do cache (solto durante a espera)
+     * @return Frame* frame do bloco ou nullptr se ausente
+     */
+    Frame* lookup(int blocknum, std::unique_lock<std::mutex>& guard);
+
+    /**
+     * @brief Aguarda a leitura antecipada do frame (e das demais do mesmo lote)
+     *
+     * @param frame frame em voo
+     * @return true dados no frame, false leitura falhou e o frame foi liberado
+     */
+    bool settle(Frame* frame);
+
+    /**
+     * @brief Libera frame sem gravar (bloco sai do cache)
+     *
+     * @param frame frame a liberar
+     */
+    void drop(Frame* frame);
+
+    /**
+     * @brief Obtem frame livre, despejando um bloco se necessario
+     *
+     * @param blocknum bloco que passa a ocupar o frame
+     * @return Frame* frame reservado
+     */
+    Frame* reserve(int blocknum);
+
+    /**
+     * @brief flush() com o lock ja obtido
+     *
+     */
+    void flush_frames();
+
+    /**
+     * @brief release() com o lock ja obtido
+     *
+     * @param guard lock do cache
+     */
+    void release_held(std::unique_lock<std::mutex>& guard);
+
+    /**
+     * @brief Escolhe o frame a ser despejado segundo a politica (frames em voo nunca)
+     *
+     * @return size_t indice do frame
+     */
+    size_t victim();
+
+    char* frame_data(const Frame* frame) { return base + (frame - &frames[0]) * disk->block_size(); }
+
+    Disk* disk = nullptr;
+    size_t Capacity;
+    Policy policy;
+    bool passthrough = false; // sem frames: cache desligado ou disco mapeado
+
+    std::vector<char> buffer;            // dados dos frames (Capacity * block_size)
+    char* base = nullptr;                // inicio alinhado dos frames em buffer (O_DIRECT)
+    std::vector<Frame> frames;           // frames em uso
+    std::unordered_map<int, size_t> map; // bloco -> indice do frame
+    std::list<size_t> lru;               // mais recente na frente
+    size_t hand = 0;                     // ponteiro do CLOCK
+    size_t inflight = 0;                 // frames com leitura antecipada em voo
+    size_t loads = 0;                    // frames em loading
+    std::mutex lock;                     // protege frames, map, lru, hand, inflight, loads e held
+    std::condition_variable loaded;      // sinalizado quando um frame sai de loading
+
+    bool retaining = false;                // write() retem o bloco em held
+    std::map<int, std::vector<char>> held; // blocos retidos ate o commit, por numero
+
+    std::atomic<size_t> Hits = 0;       // Number of reads served from memory
+    std::atomic<size_t> Misses = 0;     // Number of reads sent to disk
+    std::atomic<size_t> Writebacks = 0; // Number of dirty blocks written to disk
+    std::atomic<size_t> Prefetches = 0; // Number of blocks read ahead
+};
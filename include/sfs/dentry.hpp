@@ -0,0 +1,71 @@
+#pragma once
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+/**
+ * @brief Cache de nomes: (inode do diretorio, nome) -> inode da entrada
+ *
+ * Guarda tambem entradas negativas (nome inexistente), substituicao LRU.
+ */
+class DentryCache {
+  public:
+    /**
+     * @brief Construct a new Dentry Cache object
+     *
+     * @param capacity numero maximo de entradas (0 desliga o cache)
+     */
+    DentryCache(size_t capacity = 4096) : Capacity(capacity) {}
+    ~DentryCache();
+
+    /**
+     * @brief Procura nome no cache
+     *
+     * @param parent inode do diretorio
+     * @param name nome da entrada
+     * @param inumber inode encontrado, -1 para entrada negativa
+     * @return true entrada em cache (positiva ou negativa)
+     * @return false ausente, precisa ler o diretorio
+     */
+    bool find(uint32_t parent, const char* name, ssize_t* inumber);
+
+    /**
+     * @brief Insere ou substitui entrada, despejando a menos usada se necessario
+     *
+     * @param parent inode do diretorio
+     * @param name nome da entrada
+     * @param inumber inode da entrada ou -1 (negativa)
+     */
+    void insert(uint32_t parent, const char* name, ssize_t inumber);
+
+    /**
+     * @brief Descarta todas as entradas (unmount)
+     *
+     */
+    void clear();
+
+    size_t hits() const { return Hits; }
+    size_t misses() const { return Misses; }
+
+  private:
+    struct Entry {
+        std::string key; // inode do diretorio (4 bytes) seguido do nome
+        ssize_t inumber; // -1 negativa
+    };
+
+    /**
+     * @brief Chave de (parent, name) no mapa
+     *
+     */
+    static std::string make_key(uint32_t parent, const char* name);
+
+    size_t Capacity;
+    std::list<Entry> lru;                                            // mais recente na frente
+    std::unordered_map<std::string, std::list<Entry>::iterator> map; // chave -> posicao em lru
+
+    size_t Hits = 0;   // Number of lookups served from memory
+    size_t Misses = 0; // Number of lookups sent to the directory
+};
@@ -1,15 +1,49 @@
 #pragma once
 // #include <cstdio>
 // #include <stdlib.h>
+#include "sfs/aio.hpp"
+#include <atomic>
 #include <fstream>
+#include <mutex>
+#include <span>
+#include <sys/uio.h>
+#include <vector>
 
 class Disk {
+  public:
+    /**
+     * @brief Backend de I/O usado no arquivo de imagem
+     *
+     * Stream: std::fstream (seek + read/write)
+     * Posix: descritor com pread/pwrite posicionais
+     * Direct: Posix com O_DIRECT e buffer alinhado (sem page cache)
+     * Mmap: imagem inteira mapeada em memoria, blocos acessados sem copia
+     */
+    enum class Mode { Stream, Posix, Direct, Mmap };
+
+    /**
+     * @brief Pedido de I/O de um bloco dentro de um lote
+     *
+     */
+    struct Request {
+        int blocknum; // Block to operate on
+        char* data;   // Buffer to operate on
+    };
+
   private:
-    std::fstream file; // File descriptor of disk image
-    size_t Blocks = 0; // Number of blocks in disk image
-    size_t Reads = 0;  // Number of reads performed
-    size_t Writes = 0; // Number of writes performed
-    size_t Mounts = 0; // Number of mounts
+    std::fstream file;              // Stream of disk image (Mode::Stream)
+    std::mutex stream_lock;         // seek + read/write do fstream sao uma unica operacao
+    int fd = -1;                    // File descriptor of disk image (Mode::Posix/Direct/Mmap)
+    Mode mode = Mode::Stream;       // I/O backend in use
+    char* mapping = nullptr;        // Image mapped in memory (Mode::Mmap)
+    std::unique_ptr<AsyncIO> aio;   // Async engine (Mode::Posix/Direct)
+    size_t Bytes = 0;               // Size of disk image in bytes
+    size_t BlockSize = 0;           // Number of bytes per block
+    size_t Blocks = 0;              // Number of blocks in disk image
+    std::atomic<size_t> Reads = 0;  // Number of reads performed
+    std::atomic<size_t> Writes = 0; // Number of writes performed
+    size_t Mounts = 0;              // Number of mounts
+    std::atomic<size_t> Calls = 0;  // Number of I/O calls issued to the backend
 
     /**
      * @brief Check parameters
@@ -20,12 +54,54 @@ class Disk {
      */
     void sanity_check(int blocknum, char* data);
 
+    /**
+     * @brief Buffer precisa de copia intermediaria para O_DIRECT
+     *
+     * @param data Buffer to operate on
+     * @return true buffer nao alinhado em modo Direct
+     */
+    bool unaligned(const char* data) const;
+
+    /**
+     * @brief Le ou grava uma sequencia de blocos fisicamente contiguos
+     *
+     * @param first primeiro bloco da sequencia
+     * @param iov buffers de cada bloco, na ordem
+     * @param count numero de blocos
+     * @param write true para gravar
+     */
+    void transfer_run(int first, iovec* iov, int count, bool write);
+
+    /**
+     * @brief Agrupa pedidos de blocos adjacentes em sequencias contiguas
+     *
+     * @param requests blocos e buffers, na ordem
+     * @param write true para gravar
+     * @return std::vector<AsyncIO::Run> sequencias (no maximo IOV_MAX blocos cada)
+     */
+    std::vector<AsyncIO::Run> split(const std::vector<Request>& requests, bool write);
+
+    /**
+     * @brief Executa sincronamente as sequencias de um lote
+     *
+     * @param requests blocos e buffers, na ordem
+     * @param write true para gravar
+     */
+    void transfer(const std::vector<Request>& requests, bool write);
+
   public:
     /**
-     * @brief Number of bytes per block
+     * @brief Limites do tamanho de bloco (potencia de 2), definido na formatacao
+     *
+     */
+    const static size_t MIN_BLOCK_SIZE = 512;
+    const static size_t MAX_BLOCK_SIZE = 65536;
+
+    /**
+     * @brief Alinhamento de memoria exigido por O_DIRECT (setor logico)
      *
      */
-    const static size_t BLOCK_SIZE = 512; // 1024; // 4096;
+    const static size_t DIRECT_ALIGNMENT = 512;
 
     Disk() = default;
     ~Disk();
@@ -34,10 +110,17 @@ class Disk {
      * @brief
      *
      * @param path Path to disk image
-     * @param nblocks Number of blocks in disk image
+     * @param nblocks Number of MIN_BLOCK_SIZE blocks in disk image
+     * @param mode I/O backend
      * @throw runtime_error exception on error.
      */
-    void open(const char* path, size_t nblocks);
+    void open(const char* path, size_t nblocks, Mode mode = Mode::Stream);
+
+    /**
+     * @brief Whether or not disk image is open
+     *
+     */
+    bool is_open() const { return fd >= 0 || file.is_open(); }
 
     /**
      * @brief Get size of disk (in terms of blocks)
@@ -46,6 +129,21 @@ class Disk {
      */
     size_t size() const { return Blocks; }
 
+    /**
+     * @brief Get number of bytes per block
+     *
+     * @return size_t
+     */
+    size_t block_size() const { return BlockSize; }
+
+    /**
+     * @brief Redefine o tamanho do bloco (a capacidade em bytes nao muda)
+     *
+     * @param block_size potencia de 2 entre MIN_BLOCK_SIZE e MAX_BLOCK_SIZE
+     * @throw invalid_argument tamanho invalido ou disco montado.
+     */
+    void set_block_size(size_t block_size);
+
     /**
      * @brief Whether or not disk is mounted
      *
@@ -84,4 +182,96 @@ class Disk {
      * @param data Buffer to write from
      */
     void write(int blocknum, char* data);
+
+    /**
+     * @brief Read a batch of blocks, merging contiguous block numbers into one call
+     *
+     * @param requests blocks and buffers, in order
+     */
+    void readv(const std::vector<Request>& requests);
+
+    /**
+     * @brief Write a batch of blocks, merging contiguous block numbers into one call
+     *
+     * @param requests blocks and buffers, in order
+     */
+    void writev(const std::vector<Request>& requests);
+
+    /**
+     * @brief Submit a batch without waiting (io_uring or worker pool)
+     *
+     * Backends without an async engine complete the batch before returning.
+     *
+     * @param requests blocks and buffers, buffers must stay valid until wait()
+     * @param write true to write
+     * @return uint64_t ticket for wait() (0 if already complete)
+     */
+    uint64_t submit(const std::vector<Request>& requests, bool write);
+
+    /**
+     * @brief Hint that a run of blocks will be read soon (readahead without a cache)
+     *
+     * Mmap uses madvise, Posix/Direct posix_fadvise; Stream ignores the hint.
+     *
+     * @param first first block of the run
+     * @param count number of blocks
+     */
+    void willneed(int first, size_t count);
+
+    /**
+     * @brief Wait for a submitted batch
+     *
+     * @param ticket value returned by submit()
+     * @throw runtime_error exception on error.
+     */
+    void wait(uint64_t ticket);
+
+    /**
+     * @brief Force buffered writes down to the disk image (msync no modo Mmap)
+     *
+     */
+    void sync();
+
+    /**
+     * @brief Whether or not disk image is mapped in memory
+     *
+     */
+    bool mapped() const { return mapping != nullptr; }
+
+    /**
+     * @brief Zera uma sequencia de blocos, liberando o espaco da imagem quando possivel
+     *
+     * Usa fallocate (PUNCH_HOLE, depois ZERO_RANGE); sem suporte grava blocos zerados.
+     * Imagem menor que a sequencia e estendida com ftruncate (arquivo esparso).
+     *
+     * @param first primeiro bloco
+     * @param count numero de blocos
+     * @throw runtime_error exception on error.
+     */
+    void discard(int first, size_t count);
+
+    /**
+     * @brief Whether or not I/O from several threads runs in parallel
+     *
+     * Every backend may be called from several threads; Stream serializes them on a lock.
+     */
+    bool concurrent() const { return mode != Mode::Stream; }
+
+    /**
+     * @brief Name of the async engine used for batched I/O ("none" for Stream and Mmap)
+     *
+     */
+    const char* engine() const { return aio ? aio->name() : "none"; }
+
+    /**
+     * @brief Acesso direto ao bloco mapeado, sem copia
+     *
+     * @param blocknum Block to access
+     * @return std::span<char> bloco dentro do mapeamento (vazio se nao mapeado)
+     */
+    std::span<char> span(int blocknum);
+
+    size_t reads() const { return Reads; }
+    size_t writes() const { return Writes; }
+    size_t calls() const { return Calls; }
 };
@@ -1,22 +1,103 @@
 #ifndef __FS_HPP
 #define __FS_HPP
 
+#include "sfs/allocator.hpp"
+#include "sfs/bitmap.hpp"
+#include "sfs/cache.hpp"
+#include "sfs/dentry.hpp"
 #include "sfs/disk.hpp"
+#include "sfs/handle.hpp"
+#include "sfs/journal.hpp"
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class FileSystem {
   public:
     const static uint32_t MAGIC_NUMBER = 0xf0f03410;
-    const static uint32_t INODES_PER_BLOCK = Disk::BLOCK_SIZE / 32; // 128 to 4k block
     const static uint32_t POINTERS_PER_INODE = 5;
-    const static uint32_t POINTERS_PER_BLOCK = Disk::BLOCK_SIZE / 4; // 1024; to 4k block
     // extra to dir
-    const static uint32_t NAMESIZE = 28;                         // 16;
-    const static uint32_t DIR_PER_BLOCK = Disk::BLOCK_SIZE / 32; // 256; // 16 (**original 8 nao sei o motivo!!)
+    const static uint32_t NAMESIZE = 28; // 16;
 
-    FileSystem();
+    // Capacidade dos blocos em memoria (maior bloco), o tamanho real vem do SuperBlock
+    const static uint32_t MAX_INODES_PER_BLOCK = Disk::MAX_BLOCK_SIZE / 64;
+    const static uint32_t MAX_POINTERS_PER_BLOCK = Disk::MAX_BLOCK_SIZE / 4;
+    const static uint32_t MAX_DIR_PER_BLOCK = Disk::MAX_BLOCK_SIZE / 32;
+    const static uint32_t MAX_EXTENTS_PER_BLOCK = (Disk::MAX_BLOCK_SIZE - 4) / 12;
+
+    // extents
+    const static uint32_t EXTENTS_PER_INODE = 4;
+    const static uint16_t MODE_EXTENTS = 0x0800; // tttt e000 - inode mapeado por extents
+
+    // dados inline: arquivo pequeno ocupa a area de ponteiros/extents do inode, sem bloco de dados
+    const static uint32_t INLINE_BYTES = 52;
+    const static uint16_t MODE_INLINE = 0x0400; // tttt ei00 - dados no proprio inode
+
+    // varredura do mount: blocos por leitura, blocos de inode minimos por thread, maximo de threads
+    const static uint32_t SCAN_BATCH = 64;
+    const static uint32_t SCAN_MIN_BLOCKS = 16;
+    const static uint32_t SCAN_MAX_WORKERS = 8;
+
+    // inode do diretorio raiz, inicio de caminhos absolutos
+    const static uint32_t ROOT_INODE = 0;
+
+    // locks de inode (faixas por inumber % INODE_LOCKS)
+    const static size_t INODE_LOCKS = 64;
+
+    // diretorios mantidos abertos para resolucao de caminhos
+    const static size_t DIR_HANDLES = 64;
+
+    // diretorio com indice de hash extensivel: bloco logico 0 e o cabecalho
+    const static uint32_t DIR_MAGIC = 0x44495248;
+    const static uint32_t DIR_MAX_DEPTH = 24;   // 2^24 buckets, nomes com hash igual nao dividem alem disso
+    const static uint32_t DIR_HEADER_WORDS = 8; // sizeof(DirHeader) / 4, inicio do indice no cabecalho
+
+    // readahead dos arquivos abertos: janela inicial e maxima em blocos
+    const static uint32_t READAHEAD_MIN = 4;
+    const static uint32_t READAHEAD_MAX = 256;
+
+    // seek(SEEK_DATA/SEEK_HOLE): blocos logicos traduzidos por vez
+    const static uint32_t SEEK_BATCH = 1024;
+
+    // escrita adiada: bytes acumulados por inode e no total antes de alocar e gravar
+    const static size_t DELAYED_BYTES = 8 << 20;
+    const static size_t DELAYED_TOTAL = 32 << 20;
+
+    // SuperBlock.Clean: mapas de blocos, contadores, bitmap de inodes e descritores de grupo gravados em MapBlocks
+    const static uint32_t CLEAN_MAPS = 3;
+    // SuperBlock.Clean: montado com journal, MapBlocks acompanham cada commit (queda nao exige varredura)
+    const static uint32_t CLEAN_JOURNAL = 4;
+
+    // journal: Blocks / 32 blocos entre JOURNAL_MIN e JOURNAL_MAX, commit ao reter JOURNAL_BATCH blocos
+    const static uint32_t JOURNAL_MIN = 32;
+    const static uint32_t JOURNAL_MAX = 16384;
+    const static uint32_t JOURNAL_BATCH = 256;
+
+    // Recursos opcionais escolhidos na formatacao (SuperBlock.Features)
+    const static uint32_t FEATURE_EXTENTS = 0x1;   // novos arquivos usam extents
+    const static uint32_t FEATURE_LAZY_INIT = 0x2; // blocos de inode zerados sob demanda (SuperBlock.InodesInit)
+    const static uint32_t FEATURE_JOURNAL = 0x4;   // metadados passam pelo journal (SuperBlock.JournalBlocks)
+    const static uint32_t FEATURE_INLINE = 0x8;    // arquivos de ate INLINE_BYTES ficam no inode
+    const static uint32_t FEATURE_SPARSE = 0x10;   // blocos novos so de zeros nao sao alocados (buracos)
+
+    /**
+     * @brief Construct a new File System object
+     *
+     * @param cache_blocks numero de blocos mantidos no cache (0 desliga)
+     * @param policy politica de substituicao do cache
+     * @param cache_inodes numero de inodes mantidos em memoria
+     * @param cache_dentries numero de nomes mantidos em memoria (dentry cache)
+     */
+    FileSystem(size_t cache_blocks = 64, BlockCache::Policy policy = BlockCache::Policy::LRU, size_t cache_inodes = 1024,
+               size_t cache_dentries = 4096);
     virtual ~FileSystem();
 
   private:
@@ -28,53 +109,434 @@ class FileSystem {
         uint32_t MapBlocks;     // number of blocks to dir
         uint32_t Protected;     // ??
         char PasswordHash[257]; // root pass
-    };                          // Size 281 Bytes
+        uint32_t BlockSize;     // Number of bytes per block (0 = 512)
+        uint32_t Features;      // FEATURE_* flags
+        uint32_t Clean;         // CLEAN_MAPS: desmontado corretamente, mapas em MapBlocks validos
+        uint32_t InodesInit;    // blocos de inode ja zerados, os demais nao sao lidos (FEATURE_LAZY_INIT)
+        uint32_t JournalBlocks; // blocos do journal, logo antes de MapBlocks (FEATURE_JOURNAL)
+    };                          // Size 304 Bytes
+
+    struct Extent {
+        uint32_t Logical; // primeiro bloco do arquivo
+        uint32_t Start;   // primeiro bloco no disco (bloco folha no indice)
+        uint32_t Length;  // blocos contiguos
+    }; // size 12 Bytes
 
     struct Inode {
-        uint16_t mode;                       // tttt000r - wxrwxrwx //  01FF
-        uint16_t bonds;                      // num of link
-        uint32_t Size;                       // Size of file
-        uint32_t Direct[POINTERS_PER_INODE]; // Direct pointers
-        uint32_t Indirect;                   // Indirect pointer
-        // uint32_t Indirect2;
+        uint16_t mode;  // ttttei0r - wxrwxrwx //  01FF
+        uint16_t bonds; // num of link
+        uint32_t Size;  // Size of file
+        union {
+            struct {
+                uint32_t Direct[POINTERS_PER_INODE]; // Direct pointers
+                uint32_t Indirect;                   // Indirect pointer
+                uint32_t Indirect2;                  // Double indirect pointer
+                uint32_t Indirect3;                  // Triple indirect pointer
+            };
+            struct {
+                uint16_t Count;                    // extents (ou folhas) em uso
+                uint16_t Depth;                    // 0 extents no inode, 1 indice de folhas
+                Extent Extents[EXTENTS_PER_INODE]; // ordenados por Logical
+            };
+            char Inline[INLINE_BYTES]; // MODE_INLINE: conteudo do arquivo (Size bytes)
+        };
+        uint32_t Reserved;
+    }; // size 64 Bytes
+
+    struct CachedInode {
+        Inode node;         // copia em memoria (autoritativa enquanto no cache)
+        uint32_t refs = 0;    // referencias em uso, nao pode ser despejado
+        bool dirty = false;   // precisa ser gravado no bloco de inode
+        bool loading = false; // bloco de inode sendo lido sem o table_lock
+    };
+
+    struct GroupDesc {        // grupo de alocacao: fatia dos blocos de dados e da tabela de inodes
+        uint32_t FirstBlock;  // primeiro bloco de dados
+        uint32_t Blocks;      // blocos de dados
+        uint32_t FirstInode;  // primeiro inode
+        uint32_t Inodes;      // inodes
+        uint32_t FreeBlocks;  // blocos de dados livres (atualizado do mapa ao gravar)
+        uint32_t FreeInodes;  // inodes livres
+        uint32_t Directories; // diretorios com inode no grupo
+        uint32_t Reserved;
     }; // size 32 Bytes
 
+    struct DelayedWrite {
+        size_t offset;          // posicao no arquivo do primeiro byte
+        std::vector<char> data; // bytes sequenciais ainda sem blocos alocados
+    };
+
+    struct ExtentLeaf {
+        uint32_t Count;                        // extents em uso
+        Extent Extents[MAX_EXTENTS_PER_BLOCK]; // ordenados por Logical
+    };
+
     struct DirEntry {
         uint32_t inum;
         char Name[NAMESIZE];
     }; // 32
 
+    struct DirHeader {      // bloco logico 0 do diretorio
+        uint32_t Magic;     // DIR_MAGIC
+        uint32_t Depth;     // profundidade global: indice com 2^Depth buckets
+        uint32_t Index;     // primeiro bloco logico do indice (bucket de cada hash)
+        uint32_t Blocks;    // blocos logicos do diretorio
+        uint32_t FreeStart; // blocos de um indice antigo, reaproveitados como buckets
+        uint32_t FreeCount; // blocos ainda livres a partir de FreeStart
+        uint32_t Entries;   // nomes no diretorio
+        uint32_t Reserved;  // indice pequeno segue o cabecalho no mesmo bloco (Index 0)
+    };
+
+    struct DirBucket {                           // um bloco de entradas com os mesmos bits baixos do hash
+        uint32_t Depth;                          // profundidade local (bits do hash em comum)
+        uint32_t Count;                          // entradas em uso
+        char Reserved[sizeof(DirEntry) - 8];     // entradas alinhadas em 32 bytes
+        DirEntry Entries[MAX_DIR_PER_BLOCK - 1]; // desordenadas
+    };
+
     union Block {
-        SuperBlock Super;                      // Superblock
-        Inode Inodes[INODES_PER_BLOCK];        // Inode block
-        uint32_t Pointers[POINTERS_PER_BLOCK]; // Pointer block
-        char Data[Disk::BLOCK_SIZE];           // Data block
-        struct DirEntry Directories[FileSystem::DIR_PER_BLOCK];
-    }; // Size 4096
+        SuperBlock Super;                          // Superblock
+        Inode Inodes[MAX_INODES_PER_BLOCK];        // Inode block
+        uint32_t Pointers[MAX_POINTERS_PER_BLOCK]; // Pointer block
+        char Data[Disk::MAX_BLOCK_SIZE];           // Data block
+        struct DirEntry Directories[MAX_DIR_PER_BLOCK];
+        ExtentLeaf Leaf; // Extent leaf block
+        DirHeader Dir;    // Directory header block
+        DirBucket Bucket; // Directory bucket block
+    }; // Size MAX_BLOCK_SIZE, apenas os primeiros block_size bytes sao usados
 
   public:
     void debug(Disk* disk);
-    bool format(Disk* disk);
+
+    /**
+     * @brief Formata o disco
+     *
+     * @param disk disco a ser formatado
+     * @param blocksize bytes por bloco (512, 1K, 4K ... 64K), 0 mantem o do disco
+     * @param features recursos opcionais (FEATURE_*)
+     *
+     * Dados e mapas sao zerados com Disk::discard (sem gravar bloco a bloco); com FEATURE_LAZY_INIT
+     * apenas o bloco de inode da raiz e gravado, os demais sao zerados por create() quando usados.
+     *
+     * @return true formatado
+     * @return false disco montado, pequeno demais ou tamanho de bloco invalido
+     */
+    bool format(Disk* disk, size_t blocksize = 0, uint32_t features = 0);
 
     bool mount(Disk* disk);
 
+    /**
+     * @brief Grava cache, mapa de blocos livres e contadores de inode, marca o fs como limpo
+     *
+     * @return true desmontado
+     * @return false fs nao montado, ou escritas adiadas perdidas (o fs e desmontado mesmo assim)
+     */
+    bool unmount();
+
+    /**
+     * @brief Grava blocos sujos do cache e sincroniza o disco
+     *
+     * Com FEATURE_JOURNAL os metadados alterados vao para o journal num unico commit; os blocos
+     * voltam ao lugar depois, pelo write-back do cache.
+     *
+     * @return true sucesso
+     * @return false fs nao montado ou escritas adiadas nao gravadas (disco cheio)
+     */
+    bool sync();
+
+    // Grupos de alocacao: dados e tabela de inodes sao divididos em grupos (um bloco de mapa de dados cada).
+    // Arquivos novos ficam no grupo do diretorio pai, diretorios da raiz sao espalhados entre os grupos
+    // e os blocos de um arquivo comecam no grupo do seu inode; cada grupo e uma fatia do Allocator.
+
+    // Concorrencia: read, write, stat, open e close rodam em paralelo (namespace_lock compartilhado)
+    // e se excluem apenas por inode: leitores compartilham o lock do inode, escritores o tomam exclusivo.
+    // format, mount, unmount, sync, debug, create, remove e operacoes de caminho (touch, mkdir, lookup,
+    // open(path)) tomam namespace_lock exclusivo. Um FileHandle pertence a uma thread de cada vez.
+
     ssize_t create();
     bool remove(size_t inumber);
     ssize_t stat(size_t inumber);
 
     ssize_t read(size_t inumber, char* data, size_t length, size_t offset);
+
+    /**
+     * @brief Escreve no inode; escritas sequenciais ficam em memoria (delayed allocation)
+     *
+     * Os blocos so sao alocados, numa sequencia contigua, quando o trecho acumulado e gravado:
+     * escrita fora de sequencia, buffer cheio, read, sync ou unmount.
+     *
+     * @param inumber numero do iNode
+     * @param data dados a escrever
+     * @param length bytes a escrever
+     * @param offset posicao no arquivo
+     * @return ssize_t bytes aceitos ou -1
+     */
     ssize_t write(size_t inumber, char* data, size_t length, size_t offset);
 
     /**
-     * @brief Escreve nome de arquivo na tabela de diretorio corrente
+     * @brief Proximo trecho com dados ou proximo buraco a partir de offset (como lseek)
+     *
+     * Blocos nao alocados sao buracos e leem como zeros; o fim do arquivo conta como buraco.
+     *
+     * @param inumber numero do iNode
+     * @param offset posicao inicial
+     * @param whence SEEK_DATA ou SEEK_HOLE
+     * @return ssize_t posicao encontrada ou -1 (offset alem do fim, sem dados depois dele)
+     */
+    ssize_t seek(size_t inumber, size_t offset, int whence);
+
+    /**
+     * @brief Abre o inode: prende-o no cache e decodifica seu mapa de blocos
      *
-     * @param name  Nome do arquivo
+     * @param inumber numero do iNode
+     * @return FileHandle* arquivo aberto (valido ate close ou unmount) ou nullptr fora do range
+     */
+    FileHandle* open(size_t inumber);
+
+    /**
+     * @brief Abre arquivo pelo caminho (absoluto ou relativo ao diretorio corrente)
+     *
+     * @param path caminho com componentes separados por '/'
+     * @return FileHandle* arquivo aberto ou nullptr se o caminho nao existe
+     */
+    FileHandle* open(const char* path);
+
+    /**
+     * @brief Resolve caminho; componentes quentes vem do dentry cache, sem leitura do disco
+     *
+     * @param path caminho com componentes separados por '/'
+     * @return ssize_t inode do caminho ou -1
+     */
+    ssize_t lookup(const char* path);
+
+    /**
+     * @brief Cria diretorio (com "." e "..") no caminho
+     *
+     * @param path caminho do novo diretorio, o pai precisa existir
+     * @return ssize_t inode do diretorio ou -1 se ja existe ou o pai nao e diretorio
+     */
+    ssize_t mkdir(const char* path);
+
+    /**
+     * @brief Grava escrita adiada do arquivo e solta o inode
+     *
+     * @param handle arquivo aberto com open
+     * @return true fechado
+     * @return false handle desconhecido ou escrita adiada nao gravada por completo
+     */
+    bool close(FileHandle* handle);
+
+    /**
+     * @brief Cria arquivo e escreve seu nome no diretorio corrente
+     *
+     * Duplicatas e insercao custam O(1) leituras de bloco (indice de hash extensivel).
+     *
+     * @param name  Nome do arquivo (ate NAMESIZE - 1 caracteres)
      * @return true entrada no diretorio escrita com sucesso
-     * @return false falha na escrita de diretorio
+     * @return false nome longo demais ou falha na escrita de diretorio
      */
     bool touch(char name[FileSystem::NAMESIZE]);
 
   private:
+    friend class FileHandle;
+
+    /**
+     * @brief Le do arquivo aberto usando (e estendendo) o mapa de blocos do handle
+     *
+     * @param handle arquivo aberto
+     * @param data buffer de destino
+     * @param length bytes a ler
+     * @param offset posicao no arquivo
+     * @return ssize_t bytes lidos ou -1
+     */
+    ssize_t read(FileHandle* handle, char* data, size_t length, size_t offset);
+
+    /**
+     * @brief Ajusta a janela de readahead do handle e pede ao cache os blocos seguintes
+     *
+     * @param handle arquivo aberto
+     * @param node inode do arquivo (preso pelo handle)
+     * @param first primeiro bloco logico da leitura atual
+     * @param last ultimo bloco logico da leitura atual
+     */
+    void read_ahead(FileHandle* handle, Inode* node, size_t first, size_t last);
+
+    /**
+     * @brief create sem namespace_lock (chamado com ele exclusivo)
+     *
+     * @param group grupo preferido, os seguintes sao usados se ele nao tiver inode livre
+     */
+    ssize_t create_inode(uint32_t group);
+
+    /**
+     * @brief Grupo de alocacao do inode
+     *
+     */
+    uint32_t inode_group(size_t inumber) const { return inumber / group_inodes; }
+
+    /**
+     * @brief Grupo para um novo diretorio (Orlov simplificado)
+     *
+     * Subdiretorios ficam no grupo do pai enquanto ele tiver inodes e blocos livres acima da media;
+     * os da raiz vao para o grupo acima da media com menos diretorios.
+     *
+     * @param parent inode do diretorio pai
+     */
+    uint32_t dir_group(uint32_t parent);
+
+    /**
+     * @brief Divide dados e tabela de inodes em grupos e dimensiona os mapas livres
+     *
+     */
+    void layout_groups();
+
+    /**
+     * @brief Marca metadados como ocupados e completa os contadores dos grupos a partir dos mapas
+     *
+     * @param dirs diretorios por grupo (scan) ou nullptr para manter os carregados de MapBlocks
+     */
+    void count_groups(const std::vector<uint32_t>* dirs);
+
+    /**
+     * @brief remove sem namespace_lock (chamado com ele exclusivo)
+     *
+     */
+    bool remove_inode(size_t inumber);
+
+    /**
+     * @brief open sem namespace_lock
+     *
+     */
+    FileHandle* open_inode(size_t inumber);
+
+    /**
+     * @brief close sem namespace_lock
+     *
+     */
+    bool close_handle(FileHandle* handle);
+
+    /**
+     * @brief Caminho ate o inode, sem namespace_lock (lookup e open(path))
+     *
+     */
+    ssize_t resolve(const char* path);
+
+    /**
+     * @brief Lock do inode (faixa compartilhada por inumbers congruentes)
+     *
+     */
+    std::shared_mutex& inode_lock(size_t inumber) { return inode_locks[inumber % INODE_LOCKS]; }
+
+    /**
+     * @brief Le um trecho de blocos ja mapeados para o buffer do usuario
+     *
+     * @param blocks blocos fisicos, em ordem logica (0: buraco, lido como zeros)
+     * @param count numero de blocos
+     * @param begin posicao do primeiro byte no primeiro bloco
+     * @param data buffer de destino
+     * @param length bytes a ler (cabem nos blocos)
+     * @return size_t bytes lidos
+     */
+    size_t read_blocks(const uint32_t* blocks, size_t count, size_t begin, char* data, size_t length);
+
+    /**
+     * @brief Reconstroi mapas de blocos e inodes livres e contadores percorrendo todos os inodes
+     *
+     * @param disk disco sendo montado
+     * @return true mapas reconstruidos
+     * @return false ponteiro fora do disco
+     */
+    bool scan_inodes(Disk* disk);
+
+    /**
+     * @brief Marca em used os blocos referenciados pelos inodes de uma faixa de blocos de inode
+     *
+     * Executado em paralelo por scan_inodes, cada faixa atualiza apenas sua fatia de inode_counter.
+     *
+     * @param disk disco sendo montado (lido sem o cache)
+     * @param first primeiro bloco de inode da faixa
+     * @param last fim da faixa (exclusivo)
+     * @param used mapa de blocos da thread
+     * @param live mapa de inodes em uso da thread
+     * @param dirs diretorios por grupo encontrados pela thread
+     * @return true faixa percorrida
+     * @return false ponteiro fora do disco
+     */
+    bool scan_range(Disk* disk, uint32_t first, uint32_t last, Bitmap* used, Bitmap* live, std::vector<uint32_t>* dirs);
+
+    /**
+     * @brief Carrega mapas de blocos e inodes livres, contadores e descritores de grupo gravados em MapBlocks
+     *
+     * @return true mapas carregados
+     * @return false mapas nao cabem em MapBlocks ou descritores com outra geometria
+     */
+    bool load_maps();
+
+    /**
+     * @brief Grava mapas de blocos e inodes livres, contadores e descritores de grupo em MapBlocks
+     *
+     * @return true mapas gravados
+     * @return false mapas nao cabem em MapBlocks
+     */
+    bool save_maps();
+
+    /**
+     * @brief Imagem de MapBlocks: mapas de blocos e inodes livres, contadores e descritores de grupo
+     *
+     * @return std::vector<char> MapBlocks blocos ou vazio se os mapas nao couberem
+     */
+    std::vector<char> map_image();
+
+    /**
+     * @brief Retem no cache os blocos de MapBlocks alterados desde o ultimo commit
+     *
+     */
+    void stage_maps();
+
+    /**
+     * @brief Grava no journal os inodes sujos, mapas e demais metadados retidos (group commit)
+     *
+     * Chamado com namespace_lock exclusivo: nenhuma operacao esta pela metade.
+     *
+     * @return true transacao gravada (disco sincronizado)
+     * @return false nada a gravar
+     */
+    bool commit();
+
+    /**
+     * @brief Commit quando a transacao corrente ja retem blocos suficientes
+     *
+     */
+    void commit_due();
+
+    /**
+     * @brief Grava no lugar os blocos das transacoes do journal e esvazia o log
+     *
+     */
+    void checkpoint();
+
+    /**
+     * @brief Libera bloco; se ele esta no journal sem checkpoint, so depois dele
+     *
+     * Uma transacao antiga reaplicada no mount nao pode sobrescrever o bloco ja reusado.
+     *
+     * @param blocknum numero do bloco
+     */
+    void release_block(uint32_t blocknum);
+
+    /**
+     * @brief Grava MetaData no superblock (direto no disco)
+     *
+     */
+    void write_super();
+
+    /**
+     * @brief Calcula a geometria derivada do tamanho de bloco
+     *
+     * @param bytes bytes por bloco
+     */
+    void set_geometry(size_t bytes);
+
     /**
      * @brief Retorna iNode carregado  usando numero de iNode
      *
@@ -85,67 +547,427 @@ class FileSystem {
      */
     bool load_inode(size_t inumber, Inode* node);
 
+    /**
+     * @brief Zera os blocos de inode de InodesInit ate count e avanca a marca no superblock
+     *
+     * @param count novo total de blocos de inode inicializados
+     * @param block recebe um bloco de inodes zerado
+     */
+    void init_inodes(uint32_t count, Block* block);
+
+    /**
+     * @brief Prende o inode no cache de inodes, lendo o bloco na primeira vez
+     *
+     * @param inumber numero do iNode
+     * @param fresh inode livre que sera sobrescrito inteiro, o bloco nao e lido
+     * @return Inode* copia em memoria (valida ate release_inode) ou nullptr fora do range
+     */
+    Inode* acquire_inode(size_t inumber, bool fresh = false);
+
+    /**
+     * @brief Solta referencia obtida com acquire_inode
+     *
+     * @param inumber numero do iNode
+     * @param dirty inode foi alterado
+     */
+    void release_inode(size_t inumber, bool dirty);
+
+    /**
+     * @brief Grava inodes sujos, uma escrita por bloco de inode
+     *
+     * @param pinned grava tambem inodes presos (so sem escritores concorrentes)
+     */
+    void flush_inodes(bool pinned = true);
+
+    /**
+     * @brief Despeja inodes soltos e limpos ate caber em inode_capacity
+     *
+     */
+    void trim_inodes();
+
     /**
      * @brief Retorna o numero do proximo bloco livre se existir
      *
+     * @param goal bloco preferido: o primeiro livre a partir dele no seu grupo, senao nos seguintes
      * @return uint32_t numero do bloco ou 0 se não existir espaco livre
      */
-    uint32_t allocate_block();
+    uint32_t allocate_block(uint32_t goal);
+
+    /**
+     * @brief Traduz blocos logicos do arquivo em blocos fisicos
+     *
+     * @param node iNode do arquivo (ponteiros atualizados quando alloc)
+     * @param first primeiro bloco logico
+     * @param count quantidade de blocos logicos
+     * @param alloc aloca blocos (e bloco de indirecao) ainda nao existentes
+     * @param blocks blocos fisicos encontrados, ate o primeiro nao alocado ou disco cheio
+     * @param goal bloco preferido para a primeira alocacao sem bloco anterior (grupo do inode)
+     * @param holes sem alloc: bloco nao alocado entra como 0 e o mapeamento continua
+     * @return true todos os blocos mapeados
+     * @return false mapeamento parcial
+     */
+    bool map_blocks(Inode* node, uint32_t first, uint32_t count, bool alloc, std::vector<uint32_t>& blocks, uint32_t goal = 0,
+                    bool holes = false);
+
+    /**
+     * @brief map_blocks para inodes mapeados por extents
+     *
+     */
+    bool map_extents(Inode* node, uint32_t first, uint32_t count, bool alloc, std::vector<uint32_t>& blocks, uint32_t goal, bool holes);
+
+    /**
+     * @brief Procura o extent que contem um bloco logico (busca binaria na raiz e na folha)
+     *
+     * @param node iNode do arquivo
+     * @param logical bloco logico procurado
+     * @param extent extent encontrado, ou o anterior mais proximo (Length 0 se nenhum)
+     * @param next primeiro bloco logico mapeado depois de logical (UINT32_MAX se nenhum)
+     * @return true bloco mapeado
+     * @return false bloco nao mapeado
+     */
+    bool find_extent(const Inode* node, uint32_t logical, Extent* extent, uint32_t* next);
+
+    /**
+     * @brief Insere extent na arvore, estendendo o anterior quando contiguo
+     *
+     * @param node iNode do arquivo (raiz atualizada)
+     * @param extent novo extent, sem sobreposicao com os existentes
+     * @return true inserido
+     * @return false arvore cheia ou disco sem espaco para folha
+     */
+    bool insert_extent(Inode* node, const Extent& extent);
+
+    /**
+     * @brief Lista blocos de indirecao e de dados sob um ponteiro indireto
+     *
+     * @param disk disco de origem
+     * @param blocknum bloco de indirecao (0 nenhum)
+     * @param depth niveis ate os dados (1 simples, 2 dupla, 3 tripla)
+     * @param tables blocos de indirecao encontrados
+     * @param blocks blocos de dados encontrados
+     */
+    void list_indirect(Disk* disk, uint32_t blocknum, int depth, std::vector<uint32_t>& tables, std::vector<uint32_t>& blocks);
+
+    /**
+     * @brief Lista todos os extents e blocos folha do inode
+     *
+     * @param disk disco de origem
+     * @param node iNode do arquivo
+     * @param extents extents de dados, na ordem
+     * @param leaves blocos folha da arvore
+     */
+    void list_extents(Disk* disk, const Inode* node, std::vector<Extent>& extents, std::vector<uint32_t>& leaves);
+
+    /**
+     * @brief Aloca uma sequencia de blocos livres contiguos
+     *
+     * @param goal bloco preferido (continua o extent anterior)
+     * @param count blocos desejados
+     * @param got blocos alocados (0 se disco cheio)
+     * @return uint32_t primeiro bloco da sequencia
+     */
+    uint32_t allocate_run(uint32_t goal, uint32_t count, uint32_t* got);
+
+    /**
+     * @brief Aloca blocos e grava o trecho no disco (caminho sem adiamento de write)
+     *
+     * @param inumber numero do iNode (inicializado se ainda livre)
+     * @param data dados a escrever
+     * @param length bytes a escrever
+     * @param offset posicao no arquivo
+     * @return ssize_t bytes gravados (menos se o disco encheu) ou -1
+     */
+    ssize_t write_blocks(size_t inumber, char* data, size_t length, size_t offset);
+
+    /**
+     * @brief Grava a escrita adiada do inode
+     *
+     * @param inumber numero do iNode
+     * @return true nada pendente ou tudo gravado
+     * @return false disco cheio ou arquivo grande demais, dados nao gravados foram perdidos
+     */
+    bool flush_delayed(size_t inumber);
+
+    /**
+     * @brief Grava as escritas adiadas de todos os inodes
+     *
+     * @return true todas gravadas por completo
+     */
+    bool flush_delayed();
+
+    /**
+     * @brief Reserva para a escrita adiada: o total adiado mais length cabe nos blocos livres
+     *
+     * Chamado com table_lock. O mapa so e recontado quando a folga da ultima contagem acaba.
+     *
+     * @param length bytes a adiar
+     * @return false escrita deve ser sincrona
+     */
+    bool delayed_fits(size_t length);
+
+    /**
+     * @brief Descarta a escrita adiada do inode (arquivo removido)
+     *
+     * @param inumber numero do iNode
+     */
+    void drop_delayed(size_t inumber);
 
     /**
-     * @brief Aloca um bloco livre e retorna o mesmo por referencia em blocknum
+     * @brief Grava a escrita adiada do inode com seu lock exclusivo, se houver alguma
+     *
+     * Leitores so precisam do lock compartilhado depois disso.
+     *
+     * @param inumber numero do iNode
+     * @return true nada pendente ou tudo gravado
+     */
+    bool flush_pending(size_t inumber);
+
+    /**
+     * @brief Grava escritas adiadas de outros inodes cujo lock esteja livre (limite DELAYED_TOTAL)
+     *
+     * Inodes cujo flush falhou entram em delayed_errors.
      *
-     * @param node iNode do bloco de dados a ser gravado/Lido (para no erro apenas)
-     * @param read total a ser processado (para no erro apenas)
-     * @param orig_offset offset a ser processado (para no erro apenas)
-     * @param blocknum ponteiro de retorno do bloco livre a ser usado
-     * @param write_indirect false para escrita direta (para no erro apenas)
-     * @param indirect bloco de indireto (para no erro apenas)
-     * @return true Bloco libre encontrado
-     * @return false bloco livre não existe (para erro)
+     * @param inumber inode cujo lock exclusivo a thread ja tem
      */
-    bool check_allocation(Inode* node, int read, int orig_offset, uint32_t& blocknum, bool write_indirect, Block indirect);
+    void spill_delayed(size_t inumber);
 
     /**
-     * @brief Grava buffer de dados no bloco
+     * @brief Escrita ate end cabe no inode: arquivo ja inline, ou regular ainda sem blocos
      *
-     * @param offset posicao inicial a ser gravada no bloco
-     * @param read ponteiro da posicao de escrita nobloco (retorna o maximo escrito)
-     * @param length posicao maxima a ser gravado no bloco
-     * @param data buffer de dados a ser gravada
-     * @param blocknum numero do bloco a ser gravado
+     * @param node iNode do arquivo
+     * @param end fim da escrita (offset + length)
      */
-    void read_buffer(int offset, int* read, int length, char* data, uint32_t blocknum);
+    bool inline_fits(const Inode* node, size_t end);
 
     /**
-     * @brief Escreve o Inode no disco
+     * @brief Passa o conteudo inline para o primeiro bloco do arquivo
+     *
+     * @param inumber numero do iNode (para o grupo do bloco)
+     * @param node iNode preso pela escrita
+     * @return true arquivo mapeado por blocos
+     * @return false disco cheio, arquivo continua inline
+     */
+    bool promote_inline(size_t inumber, Inode* node);
+
+    /**
+     * @brief Tamanho maximo do arquivo segundo o mapeamento do inode
+     *
+     * @param node iNode (livre: usa o mapeamento dos novos arquivos)
+     */
+    uint64_t max_size(const Inode* node);
+
+    /**
+     * @brief Solta o inode preso pela escrita, marcando-o sujo
      *
      * @param inumber numero do inode
-     * @param node ponteiro do node com o conteudo do node a ser gravado
      * @param ret tamanho em bytes
      * @return ssize_t valor do "ret"
      */
-    ssize_t write_ret(size_t inumber, Inode* node, int ret);
+    ssize_t write_ret(size_t inumber, int ret);
+
+    /**
+     * @brief Copia parte de um bloco de dados para o buffer do usuario
+     *
+     * @param blocknum numero do bloco a ser lido
+     * @param offset posicao inicial dentro do bloco
+     * @param length bytes restantes a ler (decrementado do que foi copiado)
+     * @param ptr posicao de escrita no buffer do usuario (avancada)
+     */
+    void read_helper(uint32_t blocknum, int offset, size_t* length, char** ptr);
 
-    void read_helper(uint32_t blocknum, int offset, size_t* length, char** data, char** ptr);
+    /**
+     * @brief Acesso somente leitura a um bloco, sem copia se o disco estiver mapeado
+     *
+     * @param disk disco de origem
+     * @param blocknum numero do bloco
+     * @param scratch bloco usado como destino quando a copia e necessaria
+     * @return const Block* bloco lido (mapeamento ou scratch)
+     */
+    const Block* peek(Disk* disk, uint32_t blocknum, Block* scratch);
 
     //--- diretorios
+
+    /**
+     * @brief Insere entrada num bucket de diretorio
+     *
+     * @param nodeId inode da entrada
+     * @param name nome da entrada
+     * @param dirBlock bucket com espaco livre
+     * @return true inserida
+     * @return false nome ja existe no bucket
+     */
     bool add_dir_entry(const uint32_t& nodeId, char name[], Block* dirBlock);
+
+    /**
+     * @brief Hash do nome (FNV-1a), os bits baixos escolhem o bucket
+     *
+     */
+    static uint32_t dir_hash(const char* name);
+
+    /**
+     * @brief Le bloco logico do diretorio pelo mapa do handle
+     *
+     * @param dir diretorio aberto
+     * @param logical bloco logico
+     * @param block destino
+     * @return true lido
+     * @return false bloco nao alocado
+     */
+    bool dir_block(FileHandle* dir, uint32_t logical, Block* block);
+
+    /**
+     * @brief Grava bloco logico do diretorio (alocado se for o proximo do arquivo)
+     *
+     * @param dir diretorio aberto
+     * @param logical bloco logico
+     * @param block dados
+     * @return true gravado
+     * @return false sem espaco
+     */
+    bool dir_store(FileHandle* dir, uint32_t logical, Block* block);
+
+    /**
+     * @brief Posicao da entrada do indice: no bloco do cabecalho (Index 0) ou na regiao Index
+     *
+     * @param header cabecalho do diretorio
+     * @param slot entrada do indice
+     * @param logical bloco logico da entrada
+     * @param word posicao da entrada em Block::Pointers
+     */
+    void dir_slot(const DirHeader& header, uint32_t slot, uint32_t* logical, uint32_t* word);
+
+    /**
+     * @brief Bucket de um hash: uma leitura do indice
+     *
+     * @param dir diretorio aberto
+     * @param head bloco do cabecalho
+     * @param hash hash do nome
+     * @return uint32_t bloco logico do bucket (0 se o indice estiver corrompido)
+     */
+    uint32_t dir_bucket(FileHandle* dir, const Block* head, uint32_t hash);
+
+    /**
+     * @brief Dobra o indice (profundidade global + 1)
+     *
+     * @param dir diretorio aberto
+     * @param head bloco do cabecalho, atualizado em memoria
+     * @return true indice dobrado
+     */
+    bool dir_grow(FileHandle* dir, Block* head);
+
+    /**
+     * @brief Procura nome no diretorio
+     *
+     * @param dir diretorio aberto
+     * @param name nome procurado
+     * @return ssize_t inode da entrada ou -1
+     */
+    ssize_t dir_lookup(FileHandle* dir, const char* name);
+
+    /**
+     * @brief Insere nome no diretorio, dividindo o bucket cheio
+     *
+     * @param dir diretorio aberto
+     * @param name nome da entrada
+     * @param inumber inode da entrada
+     * @return true inserido
+     * @return false nome ja existe, sem espaco ou diretorio sem indice
+     */
+    bool dir_insert(FileHandle* dir, const char* name, uint32_t inumber);
+
+    /**
+     * @brief Diretorio aberto para resolucao de nomes (mantido aberto ate o unmount)
+     *
+     * @param inumber inode do diretorio
+     * @return FileHandle* diretorio aberto ou nullptr se nao for diretorio
+     */
+    FileHandle* open_dir(uint32_t inumber);
+
+    /**
+     * @brief Nome dentro de um diretorio, pelo dentry cache e senao pelo indice do diretorio
+     *
+     * @param parent inode do diretorio
+     * @param name nome da entrada
+     * @return ssize_t inode da entrada ou -1
+     */
+    ssize_t lookup_name(uint32_t parent, const char* name);
+
+    /**
+     * @brief Resolve caminho ate o penultimo componente
+     *
+     * @param path caminho com componentes separados por '/'
+     * @param name recebe o ultimo componente (NAMESIZE bytes)
+     * @return ssize_t inode do diretorio pai ou -1
+     */
+    ssize_t resolve_parent(const char* path, char* name);
     // void write_dir_back(Directory dir);
 
     bool mounted;
     Disk* fs_disk;
+    BlockCache cache;
     SuperBlock MetaData;
-    std::vector<bool> free_blocks;
+    Allocator free_blocks; // bit ligado = bloco ocupado, uma fatia por grupo
+    Bitmap free_inodes;    // bit ligado = inode em uso
+    uint32_t inode_hint;   // create procura a partir daqui no grupo (rotativo)
+
+    // journal de metadados (FEATURE_JOURNAL)
+    Journal journal;
+    bool journaled = false;
+    uint32_t journal_batch;              // blocos retidos que disparam o commit
+    std::vector<char> maps_image;        // MapBlocks no ultimo commit
+    std::unordered_set<uint32_t> logged; // blocos no log desde o ultimo checkpoint
+    std::vector<uint32_t> deferred;      // liberados esperando o checkpoint
+
+    // grupos de alocacao
+    std::vector<GroupDesc> groups;
+    uint32_t group_inodes; // inodes por grupo (multiplo de inodes_per_block)
 
     // quantidade de inodes usados em cada block (cada posicao do array correponde a um bloco de inode)
     std::vector<int> inode_counter;
 
-    uint32_t curr_dir;
+    // cache de inodes por numero
+    std::unordered_map<uint32_t, CachedInode> inode_table;
+    size_t inode_capacity;
+
+    // arquivos abertos
+    std::vector<std::unique_ptr<FileHandle>> handles;
+
+    // escritas adiadas por inode
+    std::unordered_map<uint32_t, DelayedWrite> delayed;
+    size_t delayed_total = 0;
+    size_t delayed_room = 0;          // bytes adiaveis na ultima contagem de blocos livres
+    size_t allocated_mark = 0;        // allocated na ultima contagem
+    std::atomic<size_t> allocated{0}; // blocos alocados desde o inicio (so cresce)
+
+    // inodes com adiados perdidos num spill, reportados no close/sync
+    std::unordered_set<uint32_t> delayed_errors;
+
+    FileHandle* curr_dir; // diretorio corrente, aberto do mount ao unmount
+
+    // nomes resolvidos e diretorios abertos por inode
+    DentryCache dcache;
+    std::unordered_map<uint32_t, FileHandle*> directories;
     std::vector<uint32_t> dir_counter;
 
     unsigned int startBlockData;
+    unsigned int startBlockJournal; // fim dos dados (startBlockMapFree sem journal)
     unsigned int startBlockMapFree;
+
+    // geometria do fs montado/formatado
+    size_t block_size;
+    uint32_t inodes_per_block;
+    uint32_t pointers_per_block;
+    uint32_t dir_per_block;
+    uint32_t extents_per_block;
+    uint32_t group_blocks; // blocos de dados por grupo (bits de um bloco de mapa)
+
+    // namespace_lock: operacoes de dados compartilham, metadados globais e caminhos sao exclusivos
+    // table_lock: inode_table, handles, delayed, delayed_errors, free_inodes, inode_counter e contadores de inode dos grupos
+    // fora do modo exclusivo
+    std::shared_mutex namespace_lock;
+    std::array<std::shared_mutex, INODE_LOCKS> inode_locks;
+    std::mutex table_lock;
+    std::condition_variable inode_loaded; // sinalizado quando uma entrada de inode_table sai de loading
 };
 
 #endif
@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+class FileSystem;
+
+/**
+ * @brief Arquivo aberto com FileSystem::open
+ *
+ * Mantem o inode preso no cache de inodes, o mapa de blocos ja decodificado e a posicao
+ * corrente: leituras sequenciais nao releem inode nem blocos de indirecao.
+ * Nao e compartilhado entre threads: cada thread abre seu proprio handle.
+ */
+class FileHandle {
+  public:
+    /**
+     * @brief Le a partir da posicao corrente e avanca
+     *
+     * @param data buffer de destino
+     * @param length bytes a ler
+     * @return ssize_t bytes lidos (0 no fim do arquivo) ou -1
+     */
+    ssize_t read(char* data, size_t length);
+
+    /**
+     * @brief Escreve a partir da posicao corrente e avanca
+     *
+     * @param data dados a escrever
+     * @param length bytes a escrever
+     * @return ssize_t bytes aceitos ou -1
+     */
+    ssize_t write(char* data, size_t length);
+
+    /**
+     * @brief Muda a posicao corrente
+     *
+     * @param offset nova posicao (pode passar do fim do arquivo)
+     * @return size_t posicao corrente
+     */
+    size_t seek(size_t offset) { return position = offset; }
+
+    /**
+     * @brief Move a posicao para o proximo trecho com dados ou buraco (FileSystem::seek)
+     *
+     * @param offset posicao inicial
+     * @param whence SEEK_DATA ou SEEK_HOLE
+     * @return ssize_t nova posicao ou -1 (posicao nao muda)
+     */
+    ssize_t seek(size_t offset, int whence);
+
+    size_t tell() const { return position; }
+    size_t inumber() const { return Inumber; }
+
+  private:
+    friend class FileSystem;
+
+    FileHandle(FileSystem* fs, size_t inumber) : fs(fs), Inumber(inumber) {}
+
+    FileSystem* fs;
+    size_t Inumber;               // inode aberto (preso ate close)
+    size_t position = 0;          // proximo byte lido ou escrito
+    std::vector<uint32_t> blocks; // bloco fisico de cada bloco logico ja mapeado
+
+    // readahead: janela cresce em leituras sequenciais e zera em acesso aleatorio
+    size_t next = 0;   // bloco logico esperado na proxima leitura sequencial
+    size_t window = 0; // blocos a manter pedidos adiante da leitura
+    size_t ahead = 0;  // fim (exclusivo) do trecho ja pedido
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include "sfs/disk.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Journal de redo dos metadados numa regiao reservada do disco
+ *
+ * Cada commit grava, numa unica escrita sequencial, descritores com os destinos, as imagens
+ * dos blocos e um bloco de commit com o checksum da transacao, seguidos de um unico sync.
+ * O mount reaplica as transacoes completas na ordem; a primeira incompleta encerra o log.
+ * Depois de um checkpoint (blocos gravados no lugar) o log recomeca no inicio da regiao.
+ *
+ * Bloco 0 da regiao: cabecalho com a sequencia da primeira transacao valida.
+ */
+class Journal {
+  public:
+    const static uint32_t MAGIC = 0x4a524e4c;
+
+    Journal() = default;
+    ~Journal();
+
+    /**
+     * @brief Associa o journal a regiao do disco
+     *
+     * @param disk disco montado
+     * @param start primeiro bloco da regiao (cabecalho)
+     * @param blocks blocos da regiao
+     */
+    void attach(Disk* disk, uint32_t start, uint32_t blocks);
+
+    /**
+     * @brief Desassocia o disco
+     *
+     */
+    void detach() { disk = nullptr; }
+
+    /**
+     * @brief Grava o cabecalho de um journal vazio (formatacao)
+     *
+     * @param disk disco sendo formatado
+     * @param start primeiro bloco da regiao
+     */
+    static void format(Disk* disk, uint32_t start);
+
+    /**
+     * @brief Reaplica no lugar as transacoes completas e recomeca o log
+     *
+     * @return size_t transacoes reaplicadas
+     */
+    size_t replay();
+
+    /**
+     * @brief Transacao com count blocos cabe no espaco restante do log
+     *
+     */
+    bool fits(size_t count) const { return head + length(count) <= Blocks; }
+
+    /**
+     * @brief Transacao com count blocos cabe num log vazio
+     *
+     */
+    bool fits_empty(size_t count) const { return 1 + length(count) <= Blocks; }
+
+    /**
+     * @brief Grava a transacao no log e sincroniza o disco (um unico sync)
+     *
+     * @param blocks destinos e imagens dos blocos, cabendo no log (fits)
+     */
+    void commit(const std::vector<Disk::Request>& blocks);
+
+    /**
+     * @brief Esvazia o log; os blocos das transacoes ja precisam estar no lugar e sincronizados
+     *
+     */
+    void reset();
+
+    size_t commits() const { return Commits; }
+
+  private:
+    struct Record {        // bloco de controle do log
+        uint32_t Magic;    // MAGIC
+        uint32_t Type;     // HEADER, DESCRIPTOR ou COMMIT
+        uint64_t Sequence; // transacao (HEADER: primeira transacao do log)
+        uint32_t Count;    // DESCRIPTOR: destinos que seguem; COMMIT: blocos da transacao
+        uint32_t Checksum; // COMMIT: FNV-1a dos descritores e imagens
+    }; // size 24 Bytes, destinos (uint32_t) seguem o Record no descritor
+
+    const static uint32_t HEADER = 1;
+    const static uint32_t DESCRIPTOR = 2;
+    const static uint32_t COMMIT = 3;
+
+    /**
+     * @brief Destinos por descritor
+     *
+     */
+    size_t targets() const { return (disk->block_size() - sizeof(Record)) / sizeof(uint32_t); }
+
+    /**
+     * @brief Blocos de log ocupados por uma transacao de count blocos
+     *
+     */
+    size_t length(size_t count) const { return count + (count + targets() - 1) / targets() + 1; }
+
+    /**
+     * @brief Continua o checksum FNV-1a com mais bytes
+     *
+     */
+    static uint32_t checksum(uint32_t hash, const char* data, size_t length);
+
+    /**
+     * @brief Grava o cabecalho com a sequencia atual
+     *
+     */
+    void write_header();
+
+    Disk* disk = nullptr;
+    uint32_t Start = 0;    // bloco do cabecalho
+    uint32_t Blocks = 0;   // blocos da regiao
+    uint32_t head = 1;     // proximo bloco livre do log (relativo a Start)
+    uint64_t sequence = 1; // proxima transacao
+
+    size_t Commits = 0;  // Number of transactions written
+    size_t Logged = 0;   // Number of blocks written to the log
+    size_t Replayed = 0; // Number of transactions replayed at mount
+};
@@ -0,0 +1,109 @@
+#include "sfs/fs.hpp"
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Diretorio com N nomes (padrao 10K, 100K e 1M): insercao, busca de nomes existentes com o cache
+// frio (remontado) e de nomes ausentes, em us/op e leituras de bloco por operacao. Sem dentry cache,
+// toda busca passa pelo indice de hash.
+
+static const size_t LOOKUPS = 10000;
+
+static void entry_name(char name[FileSystem::NAMESIZE], const char* prefix, size_t i) {
+    memset(name, 0, FileSystem::NAMESIZE);
+    snprintf(name, FileSystem::NAMESIZE, "%s%zu", prefix, i);
+}
+
+static double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool bench(const char* image, size_t entries) {
+    // blocos de 4K; um decimo do disco e tabela de inodes (64 inodes por bloco), com folga
+    const size_t fs_blocks = entries / 6 + 4096;
+    remove(image);
+    Disk disk;
+    disk.open(image, fs_blocks * (4096 / Disk::MIN_BLOCK_SIZE), Disk::Mode::Posix);
+
+    FileSystem fs(256, BlockCache::Policy::LRU, 1024, 0);
+    if (!fs.format(&disk, 4096, FileSystem::FEATURE_LAZY_INIT) || !fs.mount(&disk)) {
+        fprintf(stderr, "format/mount failed\n");
+        return false;
+    }
+
+    char name[FileSystem::NAMESIZE];
+    char path[FileSystem::NAMESIZE + 1];
+
+    auto start = std::chrono::steady_clock::now();
+    size_t reads = disk.reads();
+    for (size_t i = 0; i < entries; i++) {
+        entry_name(name, "file_", i);
+        if (!fs.touch(name)) {
+            fprintf(stderr, "touch %zu failed\n", i);
+            return false;
+        }
+    }
+    printf("%8zu entries: insert %7.2f us/op %5.2f reads/op", entries, elapsed(start) / entries,
+           (double)(disk.reads() - reads) / entries);
+
+    if (!fs.unmount() || !fs.mount(&disk)) {
+        fprintf(stderr, "remount failed\n");
+        return false;
+    }
+
+    // nomes existentes sorteados, cache frio
+    std::mt19937_64 random(entries);
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    reads = disk.reads();
+    for (size_t k = 0; k < LOOKUPS; k++) {
+        entry_name(name, "file_", random() % entries);
+        snprintf(path, sizeof(path), "/%s", name);
+        found += fs.lookup(path) >= 0;
+    }
+    printf(" | lookup %7.2f us/op %5.2f reads/op", elapsed(start) / LOOKUPS, (double)(disk.reads() - reads) / LOOKUPS);
+
+    start = std::chrono::steady_clock::now();
+    reads = disk.reads();
+    size_t absent = 0;
+    for (size_t k = 0; k < LOOKUPS; k++) {
+        entry_name(name, "none_", k);
+        snprintf(path, sizeof(path), "/%s", name);
+        absent += fs.lookup(path) < 0;
+    }
+    printf(" | miss %7.2f us/op %5.2f reads/op\n", elapsed(start) / LOOKUPS, (double)(disk.reads() - reads) / LOOKUPS);
+    fflush(stdout);
+
+    fs.unmount();
+    remove(image);
+
+    if (found != LOOKUPS || absent != LOOKUPS) {
+        fprintf(stderr, "wrong lookup results: %zu found, %zu absent\n", found, absent);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <diskfile> [entries...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<size_t> sizes = {10000, 100000, 1000000};
+    if (argc > 2) {
+        sizes.clear();
+        for (int i = 2; i < argc; i++)
+            sizes.push_back(strtoul(argv[i], nullptr, 10));
+    }
+
+    for (size_t entries : sizes) {
+        if (!bench(argv[1], entries))
+            return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+#include "sfs/fs.hpp"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// Stress multithread: escritores concorrentes (com create/remove em paralelo) e depois leituras
+// aleatorias de 4K com 1, 2, 4... threads, o cache frio a cada rodada. Cada byte lido e conferido.
+
+static const size_t FILE_BYTES = 4 << 20;
+static const size_t READ_BYTES = 4096;
+static const size_t READS_PER_THREAD = 20000;
+static const size_t CHURN = 500;
+
+static char pattern(size_t offset, size_t file) { return (char)(offset * 7 + file); }
+
+static bool write_files(FileSystem& fs, std::vector<ssize_t>& files) {
+    std::atomic<int> failed = 0;
+    std::vector<std::thread> writers;
+
+    for (size_t f = 0; f < files.size(); f++) {
+        writers.emplace_back([&, f] {
+            std::vector<char> buffer(3000); // fora do alinhamento de bloco: exercita o read-merge-write
+            for (size_t offset = 0; offset < FILE_BYTES; offset += buffer.size()) {
+                const size_t length = std::min(buffer.size(), FILE_BYTES - offset);
+                for (size_t k = 0; k < length; k++)
+                    buffer[k] = pattern(offset + k, f);
+                if (fs.write(files[f], buffer.data(), length, offset) != (ssize_t)length)
+                    failed++;
+            }
+        });
+    }
+
+    // metadados mudando durante as escritas
+    std::thread churn([&] {
+        for (size_t k = 0; k < CHURN; k++) {
+            char data[100] = {1};
+            const ssize_t inumber = fs.create();
+            if (inumber < 0 || fs.write(inumber, data, sizeof(data), 0) != sizeof(data) || !fs.remove(inumber))
+                failed++;
+        }
+    });
+
+    for (std::thread& writer : writers)
+        writer.join();
+    churn.join();
+
+    return failed == 0 && fs.sync();
+}
+
+static double read_round(FileSystem& fs, const std::vector<ssize_t>& files, unsigned threads, std::atomic<int>& failed) {
+    std::vector<std::thread> readers;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (unsigned t = 0; t < threads; t++) {
+        readers.emplace_back([&, t] {
+            std::mt19937_64 random(t + 1);
+            std::vector<char> buffer(READ_BYTES);
+            for (size_t k = 0; k < READS_PER_THREAD; k++) {
+                const size_t f = random() % files.size();
+                const size_t offset = random() % (FILE_BYTES / READ_BYTES) * READ_BYTES;
+                if (fs.read(files[f], buffer.data(), buffer.size(), offset) != (ssize_t)buffer.size()) {
+                    failed++;
+                    continue;
+                }
+                for (size_t i = 0; i < buffer.size(); i++) {
+                    if (buffer[i] != pattern(offset + i, f)) {
+                        failed++;
+                        break;
+                    }
+                }
+            }
+        });
+    }
+
+    for (std::thread& reader : readers)
+        reader.join();
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <diskfile> [threads] [stream|posix|direct]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const unsigned threads = (argc > 2) ? atoi(argv[2]) : std::thread::hardware_concurrency();
+    Disk::Mode mode = Disk::Mode::Posix;
+    if (argc > 3 && strcmp(argv[3], "stream") == 0)
+        mode = Disk::Mode::Stream;
+    else if (argc > 3 && strcmp(argv[3], "direct") == 0)
+        mode = Disk::Mode::Direct;
+
+    // imagem com folga para os arquivos de todas as threads
+    const size_t blocks = (threads * FILE_BYTES / 4096 + 4096) * (4096 / Disk::MIN_BLOCK_SIZE);
+    remove(argv[1]);
+    Disk disk;
+    disk.open(argv[1], blocks, mode);
+
+    FileSystem fs;
+    if (!fs.format(&disk, 4096, FileSystem::FEATURE_EXTENTS) || !fs.mount(&disk)) {
+        fprintf(stderr, "format/mount failed\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ssize_t> files(threads < 1 ? 1 : threads);
+    for (ssize_t& inumber : files)
+        inumber = fs.create();
+
+    auto start = std::chrono::steady_clock::now();
+    if (!write_files(fs, files)) {
+        fprintf(stderr, "concurrent writes failed\n");
+        return EXIT_FAILURE;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("write: %u threads, %.1f MB/s\n", (unsigned)files.size(), files.size() * FILE_BYTES / 1e6 / seconds);
+
+    std::atomic<int> failed = 0;
+    double single = 0;
+    for (unsigned count = 1; count <= files.size(); count *= 2) {
+        // cache frio: cada rodada comeca lendo do disco
+        if (!fs.unmount() || !fs.mount(&disk)) {
+            fprintf(stderr, "remount failed\n");
+            return EXIT_FAILURE;
+        }
+
+        seconds = read_round(fs, files, count, failed);
+        const double rate = count * READS_PER_THREAD / seconds;
+        if (count == 1)
+            single = rate;
+        printf("read: %2u threads, %9.0f reads/s, speedup %.2f\n", count, rate, rate / single);
+    }
+
+    fs.unmount();
+    if (failed != 0) {
+        fprintf(stderr, "%d reads failed or returned wrong data\n", (int)failed);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,330 @@
+#include "sfs/aio.hpp"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <format>
+#include <stdexcept>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+std::unique_ptr<AsyncIO> AsyncIO::create(int fd, unsigned depth) {
+#if __has_include(<linux/io_uring.h>)
+    try {
+        return std::make_unique<UringIO>(fd, depth);
+    } catch (std::runtime_error&) {
+        // kernel sem io_uring (ou bloqueado): cai para o pool de threads
+    }
+#endif
+    return std::make_unique<PoolIO>(fd, 4);
+}
+
+void AsyncIO::complete(Batch* batch, const Run& run, ssize_t result) {
+    if (result < 0) {
+        if (batch->error == 0)
+            batch->error = -result;
+    } else {
+        size_t expected = 0;
+        for (const iovec& v : run.iov)
+            expected += v.iov_len;
+
+        if (run.write && (size_t)result != expected) {
+            if (batch->error == 0)
+                batch->error = EIO;
+        } else if (!run.write) {
+            // blocos alem do fim da imagem ainda nao foram gravados
+            size_t skip = result;
+            for (const iovec& v : run.iov) {
+                if (skip < v.iov_len)
+                    memset((char*)v.iov_base + skip, 0, v.iov_len - skip);
+                skip = (skip > v.iov_len) ? skip - v.iov_len : 0;
+            }
+        }
+    }
+
+    batch->pending--;
+}
+
+#if __has_include(<linux/io_uring.h>)
+
+UringIO::UringIO(int fd, unsigned depth) : fd(fd), depth(depth) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring = syscall(__NR_io_uring_setup, depth, &params);
+    if (ring < 0)
+        throw std::runtime_error(std::format("io_uring_setup: {}", strerror(errno)));
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // com IORING_FEAT_SINGLE_MMAP os aneis SQ e CQ dividem o mesmo mapeamento
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        close(ring);
+        throw std::runtime_error(std::format("io_uring mmap: {}", strerror(errno)));
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+            close(ring);
+            throw std::runtime_error(std::format("io_uring mmap: {}", strerror(errno)));
+        }
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_size);
+        munmap(sq_ptr, sq_size);
+        close(ring);
+        throw std::runtime_error(std::format("io_uring mmap: {}", strerror(errno)));
+    }
+
+    char* sq = (char*)sq_ptr;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)cq_ptr;
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    this->depth = params.sq_entries;
+}
+
+UringIO::~UringIO() {
+    // nenhuma operacao pode ficar em voo com buffers liberados
+    while (in_flight > 0)
+        reap(1);
+
+    munmap(sqes, sqes_size);
+    if (cq_ptr != sq_ptr)
+        munmap(cq_ptr, cq_size);
+    munmap(sq_ptr, sq_size);
+    close(ring);
+}
+
+uint64_t UringIO::submit(std::vector<Run>&& runs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint64_t ticket = next_ticket++;
+
+    auto batch = std::make_unique<Batch>();
+    batch->runs = std::move(runs);
+    batch->pending = batch->runs.size();
+    Batch* current = batch.get();
+    batches[ticket] = std::move(batch);
+
+    unsigned queued = 0; // SQEs no anel ainda nao entregues ao kernel
+    size_t sent = 0;     // sequencias do lote ja entregues
+
+    // o kernel pode consumir so parte das SQEs: repete ate entregar todas (EINTR tambem repete;
+    // EAGAIN/EBUSY ou nenhuma consumida esperam uma conclusao, se houver alguma em voo).
+    // Falha: SQEs nao entregues saem do anel e as entregues terminam antes do lote ser descartado
+    // (o kernel ainda escreve nos buffers delas)
+    auto enter = [&]() {
+        int error = 0;
+        while (queued > 0) {
+            int ret = syscall(__NR_io_uring_enter, ring, queued, 0, 0, nullptr, 0);
+            if (ret > 0) {
+                sent += ret;
+                queued -= ret;
+                continue;
+            }
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+
+            error = (ret < 0) ? errno : EAGAIN;
+            if ((error == EAGAIN || error == EBUSY) && in_flight > queued) {
+                reap(1);
+                continue;
+            }
+            break;
+        }
+
+        if (queued == 0)
+            return;
+
+        std::atomic_ref<unsigned>(*sq_tail).store(*sq_tail - queued, std::memory_order_release);
+        in_flight -= queued;
+        current->pending -= current->runs.size() - sent;
+        while (current->pending > 0)
+            reap(1);
+        batches.erase(ticket);
+        throw std::runtime_error(std::format("io_uring_enter: {}", strerror(error)));
+    };
+
+    for (const Run& run : current->runs) {
+        // anel cheio: submete o que foi enfileirado e libera espaco
+        if (in_flight == depth) {
+            if (queued > 0)
+                enter();
+            reap(1);
+        }
+
+        const unsigned tail = *sq_tail;
+        const unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = run.write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->off = run.pos;
+        sqe->addr = (uint64_t)run.iov.data();
+        sqe->len = run.iov.size();
+        sqe->user_data = (uint64_t)&run;
+
+        sq_array[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+
+        in_flight++;
+        queued++;
+    }
+
+    if (queued > 0)
+        enter();
+
+    return ticket;
+}
+
+void UringIO::reap(unsigned min_complete) {
+    unsigned head = std::atomic_ref<unsigned>(*cq_head).load(std::memory_order_acquire);
+
+    if (head == std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire) && min_complete > 0) {
+        int ret = syscall(__NR_io_uring_enter, ring, 0, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0 && errno != EINTR)
+            throw std::runtime_error(std::format("io_uring_enter: {}", strerror(errno)));
+    }
+
+    while (head != std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire)) {
+        io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        const Run* run = (const Run*)cqe->user_data;
+
+        // localiza o lote dono da sequencia
+        for (auto& [ticket, batch] : batches) {
+            if (run >= batch->runs.data() && run < batch->runs.data() + batch->runs.size()) {
+                complete(batch.get(), *run, cqe->res);
+                break;
+            }
+        }
+
+        head++;
+        in_flight--;
+    }
+
+    std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+}
+
+void UringIO::wait(uint64_t ticket) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = batches.find(ticket);
+    if (it == batches.end())
+        return;
+
+    while (it->second->pending > 0)
+        reap(1);
+
+    int error = it->second->error;
+    batches.erase(it);
+
+    if (error != 0)
+        throw std::runtime_error(std::format("Unable to complete async I/O: {}", strerror(error)));
+}
+
+#endif
+
+PoolIO::PoolIO(int fd, unsigned workers) : fd(fd) {
+    for (unsigned i = 0; i < workers; i++)
+        threads.emplace_back(&PoolIO::worker, this);
+}
+
+PoolIO::~PoolIO() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work.notify_all();
+
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void PoolIO::worker() {
+    while (true) {
+        std::pair<Batch*, const Run*> item;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+
+            item = queue.front();
+            queue.pop_front();
+        }
+
+        const Run* run = item.second;
+        ssize_t result = run->write ? pwritev(fd, run->iov.data(), run->iov.size(), run->pos)
+                                    : preadv(fd, run->iov.data(), run->iov.size(), run->pos);
+        if (result < 0)
+            result = -errno;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            complete(item.first, *run, result);
+        }
+        done.notify_all();
+    }
+}
+
+uint64_t PoolIO::submit(std::vector<Run>&& runs) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const uint64_t ticket = next_ticket++;
+
+    auto batch = std::make_unique<Batch>();
+    batch->runs = std::move(runs);
+    batch->pending = batch->runs.size();
+
+    for (const Run& run : batch->runs)
+        queue.emplace_back(batch.get(), &run);
+
+    batches[ticket] = std::move(batch);
+    work.notify_all();
+
+    return ticket;
+}
+
+void PoolIO::wait(uint64_t ticket) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto it = batches.find(ticket);
+    if (it == batches.end())
+        return;
+
+    // submit concorrente pode rehash o mapa durante a espera: o iterador nao sobrevive, o lote sim
+    Batch* batch = it->second.get();
+    done.wait(lock, [batch] { return batch->pending == 0; });
+
+    int error = batch->error;
+    batches.erase(ticket);
+
+    if (error != 0)
+        throw std::runtime_error(std::format("Unable to complete async I/O: {}", strerror(error)));
+}
@@ -0,0 +1,176 @@
+#include "sfs/allocator.hpp"
+#include <algorithm>
+#include <sched.h>
+#include <thread>
+
+void Allocator::resize(size_t bits, size_t offset, size_t width, size_t shards) {
+    Bits = bits;
+    Offset = offset;
+    Width = width;
+
+    // fatias alinhadas a palavra: nenhuma palavra do mapa e dividida entre dois locks
+    slices.clear();
+    for (size_t k = 0; k < std::max<size_t>(shards, 1); k++) {
+        const size_t first = k ? offset + k * width : 0;
+        const size_t end = (k + 1 < shards) ? offset + (k + 1) * width : bits;
+
+        auto slice = std::make_unique<Slice>();
+        slice->first = std::min(first, bits);
+        slice->map.resize(std::min(end, bits) - slice->first);
+        slices.push_back(std::move(slice));
+    }
+}
+
+size_t Allocator::shard(size_t bit) const {
+    if (bit < Offset + Width || Width == 0)
+        return 0;
+    return std::min((bit - Offset) / Width, slices.size() - 1);
+}
+
+size_t Allocator::available(size_t index) {
+    Slice& s = *slices[index];
+    std::lock_guard<std::mutex> guard(s.lock);
+    return s.map.count_free(0, s.map.size());
+}
+
+size_t Allocator::home(size_t goal, size_t from, size_t to) const {
+    if (goal >= from && goal < to)
+        return shard(goal);
+
+    // sem sched_getcpu: espalha as threads pelo id
+    const int cpu = sched_getcpu();
+    const size_t seed = (cpu >= 0) ? (size_t)cpu : std::hash<std::thread::id>()(std::this_thread::get_id());
+    return seed % slices.size();
+}
+
+bool Allocator::test(size_t bit) {
+    Slice& s = slice(bit);
+    std::lock_guard<std::mutex> guard(s.lock);
+    return s.map.test(bit - s.first);
+}
+
+void Allocator::set(size_t bit) {
+    Slice& s = slice(bit);
+    std::lock_guard<std::mutex> guard(s.lock);
+    s.map.set(bit - s.first);
+}
+
+void Allocator::clear(size_t bit) {
+    Slice& s = slice(bit);
+    std::lock_guard<std::mutex> guard(s.lock);
+    s.map.clear(bit - s.first);
+}
+
+size_t Allocator::allocate(size_t goal, size_t from, size_t to) {
+    const size_t start = home(goal, from, to);
+
+    for (size_t k = 0; k < slices.size(); k++) {
+        Slice& s = *slices[(start + k) % slices.size()];
+        const size_t end = s.first + s.map.size();
+        if (end <= from || s.first >= to)
+            continue;
+
+        std::lock_guard<std::mutex> guard(s.lock);
+        const size_t low = std::max(from, s.first) - s.first;
+        const size_t high = std::min(to, end) - s.first;
+
+        // na fatia do goal, primeiro o trecho depois dele
+        if (k == 0 && goal > s.first + low && goal < s.first + high) {
+            const size_t bit = s.map.find_free(goal - s.first, high);
+            if (bit != high) {
+                s.map.set(bit);
+                return s.first + bit;
+            }
+        }
+
+        const size_t bit = s.map.allocate(low, high);
+        if (bit != high)
+            return s.first + bit;
+    }
+
+    return to;
+}
+
+size_t Allocator::allocate_run(size_t goal, size_t from, size_t to, size_t count, size_t* got) {
+    *got = 0;
+
+    // sequencia a partir do goal, ate o primeiro bit ocupado (ou o fim da fatia)
+    auto take = [&](Slice& s, size_t begin, size_t limit) {
+        const size_t end = s.map.find_used(begin, std::min(limit, begin + count));
+        for (size_t i = begin; i < end; i++)
+            s.map.set(i);
+        *got = end - begin;
+        return s.first + begin;
+    };
+
+    if (goal >= from && goal < to) {
+        Slice& s = slice(goal);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const size_t limit = std::min(to, s.first + s.map.size()) - s.first;
+        if (!s.map.test(goal - s.first))
+            return take(s, goal - s.first, limit);
+    }
+
+    // primeira fatia (a partir da do goal ou da CPU corrente) com sequencia completa
+    const size_t start = home(goal, from, to);
+    size_t best = 0, longest = 0;
+
+    for (size_t k = 0; k < slices.size(); k++) {
+        const size_t index = (start + k) % slices.size();
+        Slice& s = *slices[index];
+        const size_t end = s.first + s.map.size();
+        if (end <= from || s.first >= to)
+            continue;
+
+        std::lock_guard<std::mutex> guard(s.lock);
+        const size_t low = std::max(from, s.first) - s.first;
+        const size_t high = std::min(to, end) - s.first;
+
+        size_t length;
+        const size_t begin = s.map.find_run(low, high, count, &length);
+        if (length == count)
+            return take(s, begin, high);
+
+        if (length > longest) {
+            longest = length;
+            best = index;
+        }
+    }
+
+    if (longest == 0)
+        return 0;
+
+    // fatia pode ter mudado desde a busca: procura de novo e ocupa o que encontrar
+    Slice& s = *slices[best];
+    std::lock_guard<std::mutex> guard(s.lock);
+    const size_t low = std::max(from, s.first) - s.first;
+    const size_t high = std::min(to, s.first + s.map.size()) - s.first;
+
+    size_t length;
+    const size_t begin = s.map.find_run(low, high, count, &length);
+    if (length == 0)
+        return 0;
+    return take(s, begin, high);
+}
+
+std::vector<uint64_t> Allocator::data() {
+    std::vector<uint64_t> words;
+    for (auto& s : slices) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        words.insert(words.end(), s->map.data().begin(), s->map.data().end());
+    }
+    return words;
+}
+
+void Allocator::assign(const uint64_t* data, size_t bits) {
+    resize(bits, Offset, Width, slices.size());
+    for (auto& s : slices)
+        s->map.assign(data + s->first / 64, s->map.size());
+}
+
+void Allocator::merge(const Bitmap& other) {
+    for (auto& s : slices) {
+        std::lock_guard<std::mutex> guard(s->lock);
+        s->map.merge(other.data().data() + s->first / 64);
+    }
+}
@@ -0,0 +1,157 @@
+#include "sfs/bitmap.hpp"
+#include <algorithm>
+#include <bit>
+
+void Bitmap::resize(size_t bits) {
+    Bits = bits;
+    hint = 0;
+
+    const size_t count = (bits + 63) / 64;
+    words.assign(count, 0);
+    summary.assign((count + 63) / 64, 0);
+
+    // bits alem do fim ficam ocupados, a busca nunca os retorna
+    if (bits % 64)
+        words.back() = ~0ULL << (bits % 64);
+
+    for (size_t w = 0; w < count; w++) {
+        if (words[w] != ~0ULL)
+            summary[w / 64] |= 1ULL << (w % 64);
+    }
+}
+
+void Bitmap::set(size_t bit) {
+    const size_t w = bit / 64;
+    words[w] |= 1ULL << (bit % 64);
+
+    if (words[w] == ~0ULL)
+        summary[w / 64] &= ~(1ULL << (w % 64));
+}
+
+void Bitmap::clear(size_t bit) {
+    const size_t w = bit / 64;
+    words[w] &= ~(1ULL << (bit % 64));
+    summary[w / 64] |= 1ULL << (w % 64);
+
+    if (bit < hint)
+        hint = bit;
+}
+
+size_t Bitmap::next_free_word(size_t word) const {
+    size_t s = word / 64;
+    if (s >= summary.size())
+        return words.size();
+
+    uint64_t bits = summary[s] & (~0ULL << (word % 64));
+    while (bits == 0) {
+        if (++s == summary.size())
+            return words.size();
+        bits = summary[s];
+    }
+
+    return s * 64 + std::countr_zero(bits);
+}
+
+size_t Bitmap::find_free(size_t from, size_t to) const {
+    if (from >= to)
+        return to;
+
+    size_t w = from / 64;
+    uint64_t free = ~words[w] & (~0ULL << (from % 64));
+
+    // palavra inicial cheia: summary aponta a proxima com bit livre
+    if (free == 0) {
+        w = next_free_word(w + 1);
+        if (w >= words.size())
+            return to;
+        free = ~words[w];
+    }
+
+    return std::min(w * 64 + std::countr_zero(free), to);
+}
+
+size_t Bitmap::find_used(size_t from, size_t to) const {
+    if (from >= to)
+        return to;
+
+    size_t w = from / 64;
+    uint64_t used = words[w] & (~0ULL << (from % 64));
+
+    while (used == 0) {
+        if (++w * 64 >= to)
+            return to;
+        used = words[w];
+    }
+
+    return std::min(w * 64 + std::countr_zero(used), to);
+}
+
+size_t Bitmap::find_run(size_t from, size_t to, size_t count, size_t* length) const {
+    size_t best = from;
+    size_t longest = 0;
+
+    // salta de sequencia livre em sequencia livre, palavra a palavra
+    size_t pos = find_free(from, to);
+    while (pos < to && longest < count) {
+        const size_t end = find_used(pos, std::min(to, pos + count));
+        if (end - pos > longest) {
+            longest = end - pos;
+            best = pos;
+        }
+        pos = find_free(end, to);
+    }
+
+    *length = longest;
+    return best;
+}
+
+size_t Bitmap::count_free(size_t from, size_t to) const {
+    size_t used = 0;
+
+    // palavras das pontas mascaradas, as do meio contadas inteiras
+    for (size_t w = from / 64; w * 64 < to; w++) {
+        uint64_t word = words[w];
+        if (w == from / 64)
+            word &= ~0ULL << (from % 64);
+        if ((w + 1) * 64 > to)
+            word &= ~0ULL >> (64 - to % 64);
+        used += std::popcount(word);
+    }
+
+    return (to > from) ? (to - from) - used : 0;
+}
+
+size_t Bitmap::allocate(size_t from, size_t to) {
+    const size_t bit = find_free(std::max(from, hint), to);
+    if (bit == to)
+        return to;
+
+    set(bit);
+
+    // tudo entre hint e bit estava ocupado
+    if (from <= hint)
+        hint = bit + 1;
+
+    return bit;
+}
+
+void Bitmap::assign(const uint64_t* data, size_t bits) {
+    resize(bits);
+    std::copy(data, data + words.size(), words.begin());
+
+    if (bits % 64)
+        words.back() |= ~0ULL << (bits % 64);
+
+    for (size_t w = 0; w < words.size(); w++) {
+        if (words[w] == ~0ULL)
+            summary[w / 64] &= ~(1ULL << (w % 64));
+    }
+}
+
+void Bitmap::merge(const uint64_t* data) {
+    for (size_t w = 0; w < words.size(); w++) {
+        words[w] |= data[w];
+        if (words[w] == ~0ULL)
+            summary[w / 64] &= ~(1ULL << (w % 64));
+    }
+}
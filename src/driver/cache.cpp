@@ -0,0 +1,493 @@
+#include "sfs/cache.hpp"
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <string.h>
+
+BlockCache::BlockCache(size_t capacity, Policy policy) : Capacity(capacity), policy(policy) {}
+
+BlockCache::~BlockCache() {
+    if (disk != nullptr) {
+        detach();
+        std::cout << std::format("{0} cache hits", Hits.load()) << std::endl;
+        std::cout << std::format("{0} cache misses", Misses.load()) << std::endl;
+        std::cout << std::format("{0} cache writebacks", Writebacks.load()) << std::endl;
+        std::cout << std::format("{0} cache prefetches", Prefetches.load()) << std::endl;
+    }
+}
+
+void BlockCache::attach(Disk* disk) {
+    std::lock_guard<std::mutex> guard(lock);
+    this->disk = disk;
+
+    // imagem mapeada ja e o cache (page cache), copiar seria desperdicio
+    passthrough = (Capacity == 0) || disk->mapped();
+
+    frames.clear();
+    map.clear();
+    lru.clear();
+    hand = 0;
+
+    if (passthrough)
+        return;
+
+    // frames alinhados evitam copia intermediaria no modo Direct
+    size_t space = Capacity * disk->block_size() + Disk::DIRECT_ALIGNMENT;
+    buffer.assign(space, 0);
+    void* ptr = buffer.data();
+    base = (char*)std::align(Disk::DIRECT_ALIGNMENT, Capacity * disk->block_size(), ptr, space);
+    frames.reserve(Capacity); // ponteiros para frames nao podem mudar
+}
+
+void BlockCache::detach() {
+    if (disk == nullptr)
+        return;
+
+    std::unique_lock<std::mutex> guard(lock);
+
+    // buffers dos frames precisam sobreviver as leituras em voo
+    loaded.wait(guard, [this] { return loads == 0; });
+    for (Frame& frame : frames) {
+        if (frame.ticket)
+            settle(&frame);
+    }
+
+    // blocos retidos sem commit nao sao perdidos
+    release_held(guard);
+    flush_frames();
+    frames.clear();
+    map.clear();
+    lru.clear();
+}
+
+BlockCache::Frame* BlockCache::lookup(int blocknum, std::unique_lock<std::mutex>& guard) {
+    auto it = map.find(blocknum);
+
+    // bloco sendo lido por outra thread (sem o lock): espera e procura de novo, a leitura pode ter falhado
+    while (it != map.end() && frames[it->second].loading) {
+        loaded.wait(guard);
+        it = map.find(blocknum);
+    }
+
+    if (it == map.end())
+        return nullptr;
+
+    Frame* frame = &frames[it->second];
+    if (frame->ticket && !settle(frame))
+        return nullptr;
+
+    if (policy == Policy::LRU)
+        lru.splice(lru.begin(), lru, frame->lru);
+    else
+        frame->ref = true;
+
+    return frame;
+}
+
+bool BlockCache::settle(Frame* frame) {
+    const uint64_t ticket = frame->ticket;
+
+    bool failed = false;
+    try {
+        disk->wait(ticket);
+    } catch (std::runtime_error&) {
+        failed = true;
+    }
+
+    // o erro so e entregue ao primeiro wait: todo o lote e resolvido aqui
+    for (Frame& other : frames) {
+        if (other.ticket != ticket)
+            continue;
+
+        other.ticket = 0;
+        inflight--;
+        if (failed)
+            drop(&other);
+    }
+
+    return !failed;
+}
+
+void BlockCache::drop(Frame* frame) {
+    map.erase(frame->blocknum); // frame fica livre, sera reusado como vitima
+    frame->blocknum = -1;
+    frame->ref = false;
+    frame->ahead = false;
+
+    // no fim da LRU e a proxima vitima, antes dos blocos ainda uteis (lookup o trouxe para a frente)
+    if (policy == Policy::LRU)
+        lru.splice(lru.end(), lru, frame->lru);
+}
+
+size_t BlockCache::victim() {
+    if (policy == Policy::LRU) {
+        for (auto it = lru.rbegin(); it != lru.rend(); it++) {
+            if (!frames[*it].ticket && !frames[*it].loading)
+                return *it;
+        }
+    }
+
+    // CLOCK: segunda chance para frames referenciados
+    while (true) {
+        Frame& frame = frames[hand];
+        size_t index = hand;
+        hand = (hand + 1) % frames.size();
+
+        if (!frame.ref && !frame.ticket && !frame.loading)
+            return index;
+
+        frame.ref = false;
+    }
+}
+
+BlockCache::Frame* BlockCache::reserve(int blocknum) {
+    size_t index;
+
+    if (frames.size() < Capacity) {
+        index = frames.size();
+        frames.push_back(Frame{-1, false, false, false, false, 0, lru.end()});
+        if (policy == Policy::LRU)
+            frames[index].lru = lru.insert(lru.begin(), index);
+    } else {
+        index = victim();
+        Frame& old = frames[index];
+        if (old.dirty) {
+            disk->write(old.blocknum, frame_data(&old));
+            Writebacks++;
+        }
+        map.erase(old.blocknum);
+        if (policy == Policy::LRU)
+            lru.splice(lru.begin(), lru, old.lru);
+    }
+
+    Frame* frame = &frames[index];
+    frame->blocknum = blocknum;
+    frame->dirty = false;
+    frame->ref = true;
+    frame->ahead = false;
+    map[blocknum] = index;
+
+    return frame;
+}
+
+void BlockCache::read(int blocknum, char* data) {
+    std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+    if (!passthrough || retaining)
+        guard.lock();
+
+    // bloco retido e a versao mais nova
+    auto it = guard.owns_lock() ? held.find(blocknum) : held.end();
+    if (it != held.end()) {
+        Hits++;
+        memcpy(data, it->second.data(), disk->block_size());
+        return;
+    }
+
+    if (passthrough) {
+        if (guard.owns_lock())
+            guard.unlock();
+        Misses++;
+        disk->read(blocknum, data);
+        return;
+    }
+
+    Frame* frame = lookup(blocknum, guard);
+    if (frame != nullptr) {
+        Hits++;
+
+        // lido por acesso normal: passa a ser um bloco em cache como outro qualquer
+        frame->ahead = false;
+        memcpy(data, frame_data(frame), disk->block_size());
+        return;
+    }
+
+    Misses++;
+
+    // quase todos os frames com leituras em andamento: le direto, sempre sobra uma vitima
+    if (inflight + loads + 1 >= Capacity) {
+        guard.unlock();
+        disk->read(blocknum, data);
+        return;
+    }
+
+    // frame reservado sob o lock e lido sem ele: leituras de outros blocos seguem em paralelo,
+    // quem procura este bloco espera em loaded
+    frame = reserve(blocknum);
+    frame->loading = true;
+    loads++;
+    char* target = frame_data(frame);
+    guard.unlock();
+
+    try {
+        disk->read(blocknum, target);
+    } catch (...) {
+        guard.lock();
+        frame->loading = false;
+        loads--;
+        drop(frame);
+        loaded.notify_all();
+        throw;
+    }
+
+    memcpy(data, target, disk->block_size());
+
+    guard.lock();
+    frame->loading = false;
+    loads--;
+    loaded.notify_all();
+}
+
+void BlockCache::write(int blocknum, char* data) {
+    if (retaining) {
+        std::lock_guard<std::mutex> guard(lock);
+        held[blocknum].assign(data, data + disk->block_size());
+        return;
+    }
+
+    if (passthrough) {
+        disk->write(blocknum, data);
+        return;
+    }
+
+    // escrita sempre de bloco inteiro, nao precisa ler o disco
+    std::unique_lock<std::mutex> guard(lock);
+    Frame* frame = lookup(blocknum, guard);
+    if (frame == nullptr)
+        frame = reserve(blocknum);
+
+    memcpy(frame_data(frame), data, disk->block_size());
+    frame->dirty = true;
+}
+
+void BlockCache::readv(const std::vector<Disk::Request>& requests) { wait(read_async(requests)); }
+
+uint64_t BlockCache::read_async(const std::vector<Disk::Request>& requests) {
+    if (passthrough && !retaining) {
+        Misses += requests.size();
+        return disk->submit(requests, false);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    std::vector<Disk::Request> missing;
+    std::vector<std::pair<const Disk::Request*, Frame*>> found;
+    for (const Disk::Request& request : requests) {
+        auto it = held.find(request.blocknum);
+        if (it != held.end()) {
+            Hits++;
+            memcpy(request.data, it->second.data(), disk->block_size());
+            continue;
+        }
+
+        if (passthrough) {
+            Misses++;
+            missing.push_back(request);
+            continue;
+        }
+
+        Frame* frame = lookup(request.blocknum, guard);
+        if (frame != nullptr) {
+            Hits++;
+            found.emplace_back(&request, frame);
+        } else {
+            Misses++;
+            missing.push_back(request);
+        }
+    }
+
+    for (auto& [request, frame] : found) {
+        memcpy(request->data, frame_data(frame), disk->block_size());
+
+        // bloco antecipado ja consumido nao ocupa mais o frame
+        if (frame->ahead && !frame->dirty)
+            drop(frame);
+    }
+
+    // ausentes nao entram no cache: seguem para o disco sem o lock (backend sincrono le aqui)
+    guard.unlock();
+    return disk->submit(missing, false);
+}
+
+void BlockCache::prefetch(const std::vector<int>& blocknums) {
+    if (disk == nullptr || blocknums.empty())
+        return;
+
+    if (passthrough) {
+        // sem frames: sequencias contiguas viram dica ao disco
+        size_t begin = 0;
+        for (size_t i = 1; i <= blocknums.size(); i++) {
+            if (i == blocknums.size() || blocknums[i] != blocknums[i - 1] + 1) {
+                disk->willneed(blocknums[begin], i - begin);
+                begin = i;
+            }
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<Disk::Request> requests;
+    std::vector<Frame*> loading;
+    for (int blocknum : blocknums) {
+        if (inflight + loads + loading.size() >= Capacity / 2)
+            break;
+        if (map.count(blocknum))
+            continue;
+
+        // marcado em voo ja na reserva: a proxima reserva do lote nao o escolhe como vitima
+        Frame* frame = reserve(blocknum);
+        frame->ticket = UINT64_MAX;
+        frame->ahead = true;
+        requests.push_back({blocknum, frame_data(frame)});
+        loading.push_back(frame);
+    }
+
+    if (loading.empty())
+        return;
+
+    uint64_t ticket = 0;
+    try {
+        ticket = disk->submit(requests, false);
+    } catch (std::runtime_error&) {
+        // leitura antecipada e so uma dica: a leitura de verdade repete e reporta o erro
+        for (Frame* frame : loading) {
+            frame->ticket = 0;
+            drop(frame);
+        }
+        return;
+    }
+
+    // backend sincrono (ticket 0) ja completou
+    for (Frame* frame : loading)
+        frame->ticket = ticket;
+    if (ticket)
+        inflight += loading.size();
+
+    Prefetches += loading.size();
+}
+
+void BlockCache::writev(const std::vector<Disk::Request>& requests) {
+    if (passthrough && !retaining) {
+        disk->writev(requests);
+        return;
+    }
+
+    // disco e frames mudam juntos: nenhuma leitura ve o frame antigo depois da gravacao
+    // (leitura sem lock de um destes blocos termina antes, senao sobrescreveria o frame atualizado)
+    std::unique_lock<std::mutex> guard(lock);
+    loaded.wait(guard, [&] {
+        return std::none_of(requests.begin(), requests.end(), [this](const Disk::Request& request) {
+            auto it = map.find(request.blocknum);
+            return it != map.end() && frames[it->second].loading;
+        });
+    });
+    disk->writev(requests);
+
+    // copia retida ficou velha: o bloco foi reescrito direto no disco
+    for (const Disk::Request& request : requests)
+        held.erase(request.blocknum);
+
+    // copia em cache passa a refletir o disco
+    for (const Disk::Request& request : requests) {
+        auto it = map.find(request.blocknum);
+        if (it != map.end()) {
+            Frame* frame = &frames[it->second];
+            if (frame->ticket && !settle(frame))
+                continue;
+            memcpy(frame_data(frame), request.data, disk->block_size());
+            frame->dirty = false;
+        }
+    }
+}
+
+void BlockCache::flush() {
+    if (disk == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> guard(lock);
+    flush_frames();
+}
+
+void BlockCache::flush_frames() {
+    // grava em ordem de bloco, blocos adjacentes seguem numa unica chamada
+    std::vector<Frame*> dirty;
+    for (Frame& frame : frames) {
+        if (frame.dirty)
+            dirty.push_back(&frame);
+    }
+
+    std::sort(dirty.begin(), dirty.end(), [](const Frame* a, const Frame* b) { return a->blocknum < b->blocknum; });
+
+    std::vector<Disk::Request> requests;
+    for (Frame* frame : dirty)
+        requests.push_back({frame->blocknum, frame_data(frame)});
+
+    disk->writev(requests);
+
+    for (Frame* frame : dirty)
+        frame->dirty = false;
+
+    Writebacks += dirty.size();
+}
+
+void BlockCache::retain(bool on) {
+    std::unique_lock<std::mutex> guard(lock);
+    retaining = on;
+    if (!on)
+        release_held(guard);
+}
+
+size_t BlockCache::retained() {
+    std::lock_guard<std::mutex> guard(lock);
+    return held.size();
+}
+
+bool BlockCache::retains(int blocknum) {
+    std::lock_guard<std::mutex> guard(lock);
+    return held.count(blocknum) != 0;
+}
+
+std::vector<Disk::Request> BlockCache::retained_blocks() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<Disk::Request> requests;
+    for (auto& [blocknum, data] : held)
+        requests.push_back({blocknum, data.data()});
+    return requests;
+}
+
+void BlockCache::release() {
+    std::unique_lock<std::mutex> guard(lock);
+    release_held(guard);
+}
+
+void BlockCache::release_held(std::unique_lock<std::mutex>& guard) {
+    if (held.empty())
+        return;
+
+    if (passthrough) {
+        std::vector<Disk::Request> requests;
+        for (auto& [blocknum, data] : held)
+            requests.push_back({blocknum, data.data()});
+        disk->writev(requests);
+        held.clear();
+        return;
+    }
+
+    // frames sujos: gravados pelo write-back normal, ja depois do commit
+    for (auto& [blocknum, data] : held) {
+        Frame* frame = lookup(blocknum, guard);
+        if (frame == nullptr)
+            frame = reserve(blocknum);
+        memcpy(frame_data(frame), data.data(), disk->block_size());
+        frame->dirty = true;
+        frame->ahead = false;
+    }
+    held.clear();
+}
+
+void BlockCache::sync() {
+    if (disk == nullptr)
+        return;
+
+    flush();
+    disk->sync();
+}
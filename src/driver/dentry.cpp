@@ -0,0 +1,56 @@
+#include "sfs/dentry.hpp"
+#include <format>
+#include <iostream>
+#include <string.h>
+
+DentryCache::~DentryCache() {
+    if (Hits + Misses > 0) {
+        std::cout << std::format("{0} dentry hits", Hits) << std::endl;
+        std::cout << std::format("{0} dentry misses", Misses) << std::endl;
+    }
+}
+
+std::string DentryCache::make_key(uint32_t parent, const char* name) {
+    std::string key((const char*)&parent, sizeof(parent));
+    key.append(name, strnlen(name, 255));
+    return key;
+}
+
+bool DentryCache::find(uint32_t parent, const char* name, ssize_t* inumber) {
+    auto it = map.find(make_key(parent, name));
+    if (it == map.end()) {
+        Misses++;
+        return false;
+    }
+
+    Hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    *inumber = it->second->inumber;
+    return true;
+}
+
+void DentryCache::insert(uint32_t parent, const char* name, ssize_t inumber) {
+    if (Capacity == 0)
+        return;
+
+    std::string key = make_key(parent, name);
+    auto it = map.find(key);
+    if (it != map.end()) {
+        it->second->inumber = inumber;
+        lru.splice(lru.begin(), lru, it->second);
+        return;
+    }
+
+    if (map.size() >= Capacity) {
+        map.erase(lru.back().key);
+        lru.pop_back();
+    }
+
+    lru.push_front({key, inumber});
+    map.emplace(std::move(key), lru.begin());
+}
+
+void DentryCache::clear() {
+    map.clear();
+    lru.clear();
+}
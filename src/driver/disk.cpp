@@ -1,46 +1,101 @@
 #include "sfs/disk.hpp"
+#include <algorithm>
+#include <fcntl.h>
 #include <filesystem>
 #include <format>
 #include <iostream>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-void Disk::open(const char* path, size_t nblocks) {
+void Disk::open(const char* path, size_t nblocks, Mode mode) {
 
-    if (std::filesystem::exists(path)) {
-        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    size_t length = 0;
+
+    this->mode = mode;
+
+    if (mode == Mode::Stream) {
+        if (std::filesystem::exists(path)) {
+            file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        } else {
+            file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+        }
+
+        if (!file.is_open())
+            throw std::runtime_error(strerror(errno));
+
+        // get length of file:
+        file.seekg(0, file.end);
+        length = file.tellg();
     } else {
-        file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
-    }
+        int flags = O_RDWR | O_CREAT;
+        if (mode == Mode::Direct)
+            flags |= O_DIRECT;
 
-    if (!file.is_open())
-        throw std::runtime_error(strerror(errno));
+        fd = ::open(path, flags, 0644);
+        if (fd < 0)
+            throw std::runtime_error(strerror(errno));
+
+        length = lseek(fd, 0, SEEK_END);
+
+        if (mode == Mode::Mmap) {
+            // imagem precisa cobrir todos os blocos antes de mapear
+            const size_t bytes = nblocks * MIN_BLOCK_SIZE;
+            if (length < bytes && ftruncate(fd, bytes) < 0)
+                throw std::runtime_error(strerror(errno));
 
-    // get length of file:
-    file.seekg(0, file.end);
-    int length = file.tellg();
+            void* addr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED)
+                throw std::runtime_error(strerror(errno));
+
+            mapping = (char*)addr;
+        } else {
+            aio = AsyncIO::create(fd);
+        }
+    }
 
     std::cout << std::format("disk size: {}", length) << std::endl;
 
+    Bytes = nblocks * MIN_BLOCK_SIZE;
+    BlockSize = MIN_BLOCK_SIZE;
     Blocks = nblocks;
     Reads = 0;
     Writes = 0;
 }
 
 Disk::~Disk() {
-    if (file.is_open()) {
-        std::cout << std::format("{0} disk block reads", Reads) << std::endl;
-        std::cout << std::format("{0} disk block writes", Writes) << std::endl;
-        file.close();
+    if (is_open()) {
+        std::cout << std::format("{0} disk block reads", Reads.load()) << std::endl;
+        std::cout << std::format("{0} disk block writes", Writes.load()) << std::endl;
+        std::cout << std::format("{0} disk I/O calls", Calls.load()) << std::endl;
     }
+
+    // operacoes assincronas terminam antes de fechar o descritor
+    aio.reset();
+
+    if (mapping != nullptr) {
+        msync(mapping, Bytes, MS_SYNC);
+        munmap(mapping, Bytes);
+    }
+
+    if (file.is_open())
+        file.close();
+
+    if (fd >= 0)
+        ::close(fd);
 }
 
+bool Disk::unaligned(const char* data) const { return (mode == Mode::Direct) && ((uintptr_t)data % DIRECT_ALIGNMENT != 0); }
+
 void Disk::sanity_check(int blocknum, char* data) {
 
     if (blocknum < 0)
-        throw std::invalid_argument(std::format("blocknum (%d) is negative!", blocknum));
+        throw std::invalid_argument(std::format("blocknum ({}) is negative!", blocknum));
 
     if (blocknum >= (int)Blocks)
-        throw std::invalid_argument(std::format("blocknum (%d) is too big!", blocknum));
+        throw std::invalid_argument(std::format("blocknum ({}) is too big!", blocknum));
 
     if (data == nullptr)
         throw std::invalid_argument("nullptr data pointer!");
@@ -49,26 +104,236 @@ void Disk::sanity_check(int blocknum, char* data) {
 void Disk::read(int blocknum, char* data) {
     sanity_check(blocknum, data);
 
-    const size_t pos = blocknum * BLOCK_SIZE;
+    iovec iov = {data, BlockSize};
+    transfer_run(blocknum, &iov, 1, false);
+}
 
-    if (!file.seekg(pos))
-        throw std::runtime_error(std::format("Unable to lseek %d: %s", blocknum, strerror(errno)));
+void Disk::write(int blocknum, char* data) {
+    sanity_check(blocknum, data);
+
+    iovec iov = {data, BlockSize};
+    transfer_run(blocknum, &iov, 1, true);
+}
 
-    if (!file.read(data, BLOCK_SIZE))
-        throw std::runtime_error(std::format("Unable to read % d : % s ", blocknum, strerror(errno)));
+void Disk::set_block_size(size_t block_size) {
+    if (mounted())
+        throw std::invalid_argument("block size of a mounted disk can not change!");
 
-    Reads++;
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0)
+        throw std::invalid_argument(std::format("invalid block size ({})!", block_size));
+
+    BlockSize = block_size;
+    Blocks = Bytes / BlockSize;
 }
 
-void Disk::write(int blocknum, char* data) {
-    sanity_check(blocknum, data);
+void Disk::transfer_run(int first, iovec* iov, int count, bool write) {
+    const size_t pos = first * BlockSize;
+    const size_t bytes = count * BlockSize;
+
+    if (mode == Mode::Stream) {
+        std::lock_guard<std::mutex> guard(stream_lock);
+        if (write ? !file.seekp(pos) : !file.seekg(pos))
+            throw std::runtime_error(std::format("Unable to lseek {}: {}", first, strerror(errno)));
+
+        for (int i = 0; i < count; i++) {
+            if (write ? !file.write((char*)iov[i].iov_base, BlockSize) : !file.read((char*)iov[i].iov_base, BlockSize))
+                throw std::runtime_error(std::format("Unable to transfer {}: {}", first + i, strerror(errno)));
+        }
+    } else if (mode == Mode::Mmap) {
+        for (int i = 0; i < count; i++) {
+            char* block = mapping + pos + i * BlockSize;
+            if (write)
+                memcpy(block, iov[i].iov_base, BlockSize);
+            else
+                memcpy(iov[i].iov_base, block, BlockSize);
+        }
+    } else {
+        // O_DIRECT: se algum buffer nao estiver alinhado usa um unico buffer intermediario
+        bool bounce = false;
+        for (int i = 0; i < count && !bounce; i++)
+            bounce = unaligned((char*)iov[i].iov_base);
+
+        char* staging = nullptr;
+        iovec single;
+        iovec* vec = iov;
+        int nvec = count;
+
+        if (bounce) {
+            staging = (char*)aligned_alloc(DIRECT_ALIGNMENT, bytes);
+            if (staging == nullptr)
+                throw std::runtime_error(strerror(errno));
+
+            if (write) {
+                for (int i = 0; i < count; i++)
+                    memcpy(staging + i * BlockSize, iov[i].iov_base, BlockSize);
+            }
+
+            single = {staging, bytes};
+            vec = &single;
+            nvec = 1;
+        }
+
+        ssize_t done = write ? pwritev(fd, vec, nvec, pos) : preadv(fd, vec, nvec, pos);
+        if (done < 0 || (write && done != (ssize_t)bytes)) {
+            free(staging);
+            throw std::runtime_error(std::format("Unable to transfer {}: {}", first, strerror(errno)));
+        }
+
+        if (!write) {
+            // blocos alem do fim da imagem ainda nao foram gravados
+            for (int i = 0; i < count; i++) {
+                char* block = bounce ? staging + i * BlockSize : (char*)iov[i].iov_base;
+                ssize_t valid = std::clamp(done - (ssize_t)(i * BlockSize), (ssize_t)0, (ssize_t)BlockSize);
+                memset(block + valid, 0, BlockSize - valid);
+                if (bounce)
+                    memcpy(iov[i].iov_base, block, BlockSize);
+            }
+        }
+
+        free(staging);
+    }
+
+    if (write)
+        Writes += count;
+    else
+        Reads += count;
+    Calls++;
+}
 
-    const size_t pos = blocknum * BLOCK_SIZE;
-    if (!file.seekp(pos))
-        throw std::runtime_error(std::format("Unable to lseek %d: %s", blocknum, strerror(errno)));
+std::vector<AsyncIO::Run> Disk::split(const std::vector<Request>& requests, bool write) {
+    std::vector<AsyncIO::Run> runs;
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        sanity_check(requests[i].blocknum, requests[i].data);
+
+        // abre nova sequencia quando o bloco nao e adjacente ao anterior
+        if (i == 0 || requests[i].blocknum != requests[i - 1].blocknum + 1 || runs.back().iov.size() == IOV_MAX)
+            runs.push_back({(off_t)(requests[i].blocknum * BlockSize), {}, write});
+
+        runs.back().iov.push_back({requests[i].data, BlockSize});
+    }
+
+    return runs;
+}
+
+void Disk::transfer(const std::vector<Request>& requests, bool write) {
+    for (AsyncIO::Run& run : split(requests, write))
+        transfer_run(run.pos / BlockSize, run.iov.data(), run.iov.size(), write);
+}
+
+void Disk::readv(const std::vector<Request>& requests) { transfer(requests, false); }
+
+void Disk::writev(const std::vector<Request>& requests) { transfer(requests, true); }
+
+uint64_t Disk::submit(const std::vector<Request>& requests, bool write) {
+    // O_DIRECT com buffer nao alinhado precisa da copia intermediaria do caminho sincrono
+    bool async = (aio != nullptr) && !requests.empty();
+    for (size_t i = 0; i < requests.size() && async; i++)
+        async = !unaligned(requests[i].data);
+
+    if (!async) {
+        transfer(requests, write);
+        return 0;
+    }
+
+    std::vector<AsyncIO::Run> runs = split(requests, write);
+    Calls += runs.size();
+    if (write)
+        Writes += requests.size();
+    else
+        Reads += requests.size();
+
+    return aio->submit(std::move(runs));
+}
+
+void Disk::wait(uint64_t ticket) {
+    if (ticket != 0)
+        aio->wait(ticket);
+}
+
+void Disk::sync() {
+    if (mode == Mode::Stream) {
+        std::lock_guard<std::mutex> guard(stream_lock);
+        if (!file.flush())
+            throw std::runtime_error(std::format("Unable to sync: {}", strerror(errno)));
+    } else if (mode == Mode::Mmap) {
+        if (msync(mapping, Bytes, MS_SYNC) < 0)
+            throw std::runtime_error(std::format("Unable to sync: {}", strerror(errno)));
+    } else if (fdatasync(fd) < 0) {
+        throw std::runtime_error(std::format("Unable to sync: {}", strerror(errno)));
+    }
+}
+
+void Disk::willneed(int first, size_t count) {
+    if (first < 0 || count == 0 || first + count > Blocks)
+        return;
+
+    const off_t pos = (off_t)first * BlockSize;
+    const off_t bytes = (off_t)count * BlockSize;
+
+    if (mapping != nullptr) {
+        // madvise exige endereco alinhado a pagina
+        const off_t page = sysconf(_SC_PAGESIZE);
+        const off_t start = pos - pos % page;
+        madvise(mapping + start, pos + bytes - start, MADV_WILLNEED);
+    } else if (fd >= 0) {
+        posix_fadvise(fd, pos, bytes, POSIX_FADV_WILLNEED);
+    }
+}
+
+void Disk::discard(int first, size_t count) {
+    if (count == 0)
+        return;
+
+    if (first < 0 || first + count > Blocks)
+        throw std::invalid_argument(std::format("blocks {}..{} out of disk!", first, first + count - 1));
+
+    const off_t pos = (off_t)first * BlockSize;
+    const off_t bytes = (off_t)count * BlockSize;
+
+    if (fd >= 0) {
+        // trecho alem do fim da imagem vira buraco do arquivo esparso
+        off_t length = lseek(fd, 0, SEEK_END);
+        if (length < pos + bytes) {
+            if (ftruncate(fd, pos + bytes) < 0)
+                throw std::runtime_error(std::format("Unable to truncate: {}", strerror(errno)));
+        }
+
+        Calls++;
+        if (length <= pos)
+            return;
+
+        const off_t end = std::min(length, pos + bytes);
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, end - pos) == 0)
+            return;
+        if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, pos, end - pos) == 0)
+            return;
+    }
+
+    // fstream ou sistema de arquivos sem fallocate: grava zeros em sequencias de IOV_MAX blocos
+    char* zero = (char*)aligned_alloc(DIRECT_ALIGNMENT, BlockSize);
+    if (zero == nullptr)
+        throw std::runtime_error(strerror(errno));
+    memset(zero, 0, BlockSize);
+
+    std::vector<iovec> iov(std::min<size_t>(count, IOV_MAX), {zero, BlockSize});
+    try {
+        for (size_t done = 0; done < count; done += iov.size()) {
+            const size_t run = std::min(count - done, iov.size());
+            transfer_run(first + done, iov.data(), run, true);
+        }
+    } catch (...) {
+        free(zero);
+        throw;
+    }
+
+    free(zero);
+}
 
-    if (!file.write(data, BLOCK_SIZE))
-        throw std::runtime_error(std::format("Unable to write %d: %s", blocknum, strerror(errno)));
+std::span<char> Disk::span(int blocknum) {
+    if (mapping == nullptr)
+        return {};
 
-    Writes++;
+    sanity_check(blocknum, mapping);
+    return std::span<char>(mapping + blocknum * BlockSize, BlockSize);
 }
@@ -3,8 +3,13 @@
 #include <algorithm>
 #include <assert.h>
 #include <cmath>
+#include <exception>
+#include <memory>
+#include <stdexcept>
 #include <stdio.h>
 #include <string.h>
+#include <thread>
+#include <unistd.h>
 
 #define streq(a, b) (strcmp((a), (b)) == 0) // TODO: solucao idiota
 
@@ -12,18 +17,33 @@
 #define startBlockSuper 0
 #define startBlockInode 1
 
-FileSystem::FileSystem() : mounted(false), fs_disk(nullptr) {
+FileSystem::FileSystem(size_t cache_blocks, BlockCache::Policy policy, size_t cache_inodes, size_t cache_dentries)
+    : mounted(false), fs_disk(nullptr), cache(cache_blocks, policy), inode_capacity(cache_inodes), curr_dir(nullptr), dcache(cache_dentries) {
     startBlockData = -1;
+    startBlockJournal = -1;
     startBlockMapFree = -1;
+    group_inodes = 1;
+    journal_batch = JOURNAL_BATCH;
+    set_geometry(Disk::MIN_BLOCK_SIZE);
 }
 
-FileSystem::~FileSystem() {}
+FileSystem::~FileSystem() {
+    if (mounted)
+        unmount();
+}
 
 void FileSystem::debug(Disk* disk) {
-    SuperBlock super;
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    Block scratch;
+
+    // inodes alterados em memoria precisam estar nos blocos lidos abaixo
+    if (mounted && disk == fs_disk) {
+        flush_delayed();
+        flush_inodes();
+    }
 
     // Read Superblock
-    disk->read(startBlockSuper, (char*)&super);
+    SuperBlock super = peek(disk, startBlockSuper, &scratch)->Super;
 
     printf("SuperBlock:\n");
     printf("    %u blocks\n", super.Blocks);
@@ -33,32 +53,96 @@ void FileSystem::debug(Disk* disk) {
     if (super.MagicNumber != MAGIC_NUMBER)
         return;
 
+    const size_t bytes = super.BlockSize ? super.BlockSize : Disk::MIN_BLOCK_SIZE;
+    printf("    %zu bytes per block\n", bytes);
+    if (super.Features & FEATURE_JOURNAL)
+        printf("    %u journal blocks\n", super.JournalBlocks);
+
+    // disco nao montado: adota a geometria gravada no superblock
+    if (!disk->mounted()) {
+        try {
+            disk->set_block_size(bytes);
+        } catch (std::invalid_argument&) {
+            return;
+        }
+        set_geometry(bytes);
+    }
+
+    // grupos de alocacao do fs montado (contadores em memoria)
+    if (mounted && disk == fs_disk) {
+        for (uint32_t g = 0; g < groups.size(); g++) {
+            GroupDesc& desc = groups[g];
+            desc.FreeBlocks = free_blocks.available(g);
+            printf("Group %u:\n", g);
+            printf("    data blocks: %u-%u (%u free)\n", desc.FirstBlock, desc.FirstBlock + desc.Blocks - 1, desc.FreeBlocks);
+            printf("    inodes: %u-%u (%u free, %u directories)\n", desc.FirstInode, desc.FirstInode + desc.Inodes - 1, desc.FreeInodes,
+                   desc.Directories);
+        }
+    }
+
     int ii = 0;
 
-    // Read Inode blocks
-    Block block;
-    for (uint32_t i = startBlockInode; i <= super.InodeBlocks; i++) {
-        disk->read(i, block.Data);
-        for (uint32_t j = 0; j < INODES_PER_BLOCK; j++) {
-            if (block.Inodes[j].bonds > 0) {
+    // Read Inode blocks (lazy: blocos ainda nao zerados nao tem inodes)
+    const uint32_t init = (super.Features & FEATURE_LAZY_INIT) ? super.InodesInit : super.InodeBlocks;
+    for (uint32_t i = startBlockInode; i <= init; i++) {
+        Block block;
+        const Block* inodes = peek(disk, i, &block);
+        for (uint32_t j = 0; j < inodes_per_block; j++) {
+            const Inode& node = inodes->Inodes[j];
+            if (node.bonds > 0) {
                 printf("Inode %u:\n", ii);
-                printf("    size: %u bytes\n", block.Inodes[j].Size);
+                printf("    size: %u bytes\n", node.Size);
+
+                if (node.mode & MODE_INLINE) {
+                    printf("    inline data\n");
+                    ii++;
+                    continue;
+                }
+
+                if (node.mode & MODE_EXTENTS) {
+                    std::vector<Extent> extents;
+                    std::vector<uint32_t> leaves;
+                    list_extents(disk, &node, extents, leaves);
+
+                    printf("    extents:");
+                    for (const Extent& extent : extents)
+                        printf(" %u:%u+%u", extent.Logical, extent.Start, extent.Length);
+                    printf("\n");
+
+                    if (!leaves.empty()) {
+                        printf("    extent leaves:");
+                        for (uint32_t leaf : leaves)
+                            printf(" %u", leaf);
+                        printf("\n");
+                    }
+
+                    ii++;
+                    continue;
+                }
+
                 printf("    direct blocks:");
 
                 for (uint32_t k = 0; k < POINTERS_PER_INODE; k++) {
-                    if (block.Inodes[j].Direct[k])
-                        printf(" %u", block.Inodes[j].Direct[k]);
+                    if (node.Direct[k])
+                        printf(" %u", node.Direct[k]);
                 }
                 printf("\n");
 
-                if (block.Inodes[j].Indirect) {
-                    printf("    indirect block: %u\n    indirect data blocks:", block.Inodes[j].Indirect);
-                    Block IndirectBlock;
-                    disk->read(block.Inodes[j].Indirect, IndirectBlock.Data);
-                    for (uint32_t k = 0; k < POINTERS_PER_BLOCK; k++) {
-                        if (IndirectBlock.Pointers[k])
-                            printf(" %u", IndirectBlock.Pointers[k]);
-                    }
+                const char* names[] = {"indirect", "double indirect", "triple indirect"};
+                const uint32_t roots[] = {node.Indirect, node.Indirect2, node.Indirect3};
+                for (int depth = 1; depth <= 3; depth++) {
+                    if (!roots[depth - 1])
+                        continue;
+
+                    std::vector<uint32_t> tables, blocks;
+                    list_indirect(disk, roots[depth - 1], depth, tables, blocks);
+
+                    printf("    %s block:", names[depth - 1]);
+                    for (uint32_t table : tables)
+                        printf(" %u", table);
+                    printf("\n    %s data blocks:", names[depth - 1]);
+                    for (uint32_t data : blocks)
+                        printf(" %u", data);
                     printf("\n");
                 }
             }
@@ -68,11 +152,50 @@ void FileSystem::debug(Disk* disk) {
     }
 }
 
-bool FileSystem::format(Disk* disk) {
+const FileSystem::Block* FileSystem::peek(Disk* disk, uint32_t blocknum, Block* scratch) {
+    // imagem mapeada: bloco e lido no lugar, sem copia
+    // bloco retido para o journal ainda nao esta no mapeamento
+    std::span<char> mapped = disk->span(blocknum);
+    if (!mapped.empty() && !(journaled && disk == fs_disk && cache.retains(blocknum)))
+        return (const Block*)mapped.data();
+
+    if (disk == fs_disk)
+        cache.read(blocknum, scratch->Data);
+    else
+        disk->read(blocknum, scratch->Data);
+
+    return scratch;
+}
+
+void FileSystem::set_geometry(size_t bytes) {
+    block_size = bytes;
+    inodes_per_block = bytes / sizeof(Inode);
+    pointers_per_block = bytes / sizeof(uint32_t);
+    dir_per_block = bytes / sizeof(DirEntry);
+    extents_per_block = (bytes - sizeof(uint32_t)) / sizeof(Extent);
+    group_blocks = 8 * bytes;
+}
+
+bool FileSystem::format(Disk* disk, size_t blocksize, uint32_t features) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
 
     if (disk->mounted())
         return false;
 
+    if (blocksize != 0) {
+        try {
+            disk->set_block_size(blocksize);
+        } catch (std::invalid_argument&) {
+            return false;
+        }
+    }
+
+    set_geometry(disk->block_size());
+
+    // superblock, inode, dois blocos do diretorio raiz e mapa
+    if (disk->size() < 5)
+        return false;
+
     // Cria SuperBlock
     Block block;
     memset(&block, 0, sizeof(Block));
@@ -81,64 +204,64 @@ bool FileSystem::format(Disk* disk) {
     block.Super.MagicNumber = FileSystem::MAGIC_NUMBER;
     block.Super.Blocks = disk->size();
     block.Super.InodeBlocks = (uint32_t)std::ceil((int(block.Super.Blocks) * 1.00) / 10);
-    block.Super.Inodes = block.Super.InodeBlocks * (FileSystem::INODES_PER_BLOCK);
+    block.Super.Inodes = block.Super.InodeBlocks * (inodes_per_block);
     block.Super.MapBlocks = (uint32_t)std::ceil((int(block.Super.Blocks) * 1.00) / 100);
+    block.Super.BlockSize = block_size;
+    block.Super.Features = features;
+
+    // journal: regiao proporcional ao disco, limitada
+    if (features & FEATURE_JOURNAL) {
+        const uint32_t size = block.Super.Blocks / 32;
+        block.Super.JournalBlocks = size < JOURNAL_MIN ? JOURNAL_MIN : size > JOURNAL_MAX ? JOURNAL_MAX : size;
+    }
 
     // Define parametros de segurança
     block.Super.Protected = 0;                // Zera campos segurança
     memset(block.Super.PasswordHash, 0, 257); // Zera hash root
-    disk->write(startBlockSuper, block.Data);
 
     // Define inicio de blocos de dados e diretorio
     startBlockData = startBlockInode + block.Super.InodeBlocks;
     startBlockMapFree = block.Super.Blocks - block.Super.MapBlocks;
+    startBlockJournal = startBlockMapFree - block.Super.JournalBlocks;
 
-    // Zera Blocos de Inode
-    for (uint32_t i = startBlockInode; i < startBlockData; i++) {
-        Block inodeBlock;
-        for (uint32_t j = 0; j < FileSystem::INODES_PER_BLOCK; j++) {
-            inodeBlock.Inodes[j].bonds = 0;
-            inodeBlock.Inodes[j].mode = 0; // 0x01ff; tttt 000r wxrw xrwx
-            inodeBlock.Inodes[j].Size = 0;
-
-            for (uint32_t k = 0; k < FileSystem::POINTERS_PER_INODE; k++)
-                inodeBlock.Inodes[j].Direct[k] = 0;
-
-            inodeBlock.Inodes[j].Indirect = 0;
-        }
+    // diretorio raiz precisa de dois blocos de dados
+    if (startBlockJournal < startBlockData + 2 || startBlockJournal > startBlockMapFree)
+        return false;
 
-        disk->write(i, inodeBlock.Data);
-    }
+    // Zera Blocos de Inode (bonds, mode, Size e ponteiros/extents); lazy: so o da raiz, gravado abaixo
+    block.Super.InodesInit = (features & FEATURE_LAZY_INIT) ? 1 : block.Super.InodeBlocks;
+    disk->discard(startBlockInode + 1, block.Super.InodesInit - 1);
 
-    // Zera Bloco de Dados depois dos blocos de inode
-    for (uint32_t i = startBlockData; i < startBlockMapFree; i++) {
-        Block DataBlock;
-        memset(DataBlock.Data, 0, Disk::BLOCK_SIZE);
-        disk->write(i, DataBlock.Data);
-    }
+    // Zera Blocos de Dados, journal e Mapa Free de uma vez (buraco no arquivo de imagem)
+    disk->discard(startBlockData, block.Super.Blocks - startBlockData);
+    if (features & FEATURE_JOURNAL)
+        Journal::format(disk, startBlockJournal);
 
-    // Zera Bloco Mapa Free
-    for (uint32_t i = startBlockMapFree; i < block.Super.Blocks; i++) {
-        Block FreeBlock;
-        memset(FreeBlock.Data, 0, Disk::BLOCK_SIZE);
-        disk->write(i, FreeBlock.Data);
-    }
+    disk->write(startBlockSuper, block.Data);
 
     // Cria entrada diretorio root
     Block blockINode;
-    disk->read(startBlockInode, blockINode.Data); // Le bloco 0 de iNode
-    Inode* node = &blockINode.Inodes[0];          // pega Inode
-    (node->bonds)++;                              // Marca coo valido
-    node->mode = 0b0000000100100100;              // 0000 000r--r--r-- Diretorio
-    node->Direct[0] = startBlockData;             // Aloca primeiro inode data valido
+    memset(blockINode.Data, 0, block_size); // bloco 0 de iNode
+    Inode* node = &blockINode.Inodes[0];    // pega Inode
+    (node->bonds)++;                        // Marca coo valido
+    node->mode = 0b0000000100100100;        // 0000 000r--r--r-- Diretorio
+    node->Direct[0] = startBlockData;       // cabecalho com o indice inicial
+    node->Direct[1] = startBlockData + 1;   // unico bucket
+    node->Size = 2 * block_size;
+
+    // inicializa Diretorio root: profundidade 0, a unica entrada do indice aponta o bucket
+    Block head;
+    memset(&head, 0, sizeof(Block));
+    head.Dir = {DIR_MAGIC, 0, 0, 2, 0, 0, 2, 0};
+    head.Pointers[DIR_HEADER_WORDS] = 1;
 
-    // inicializa Diretorio root
     Block Dirblock;
     memset(&Dirblock, 0, sizeof(Block));
 
     if (this->add_dir_entry(0, (char*)".", &Dirblock) == true) {
         if (this->add_dir_entry(0, (char*)"..", &Dirblock) == true) {
-            disk->write(node->Direct[0], Dirblock.Data);
+            disk->write(node->Direct[0], head.Data);
+            disk->write(node->Direct[1], Dirblock.Data);
             disk->write(startBlockInode, blockINode.Data);
             return true;
         }
@@ -148,29 +271,51 @@ bool FileSystem::format(Disk* disk) {
 }
 
 bool FileSystem::mount(Disk* disk) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
 
     if (disk->mounted())
         return false;
 
-    // Le o Superblock e valida totalizadores
+    // Le o Superblock (cabe no menor bloco) e valida totalizadores
     Block block;
+    disk->set_block_size(Disk::MIN_BLOCK_SIZE);
     disk->read(startBlockSuper, block.Data);
 
     if (block.Super.MagicNumber != MAGIC_NUMBER)
         return false;
 
+    // imagens antigas nao gravam o tamanho do bloco
+    try {
+        disk->set_block_size(block.Super.BlockSize ? block.Super.BlockSize : Disk::MIN_BLOCK_SIZE);
+    } catch (std::invalid_argument&) {
+        return false;
+    }
+
+    set_geometry(disk->block_size());
+
+    if (block.Super.Blocks > disk->size())
+        return false;
+
     if (block.Super.InodeBlocks != std::ceil((block.Super.Blocks * 1.00) / 10))
         return false;
 
-    if (block.Super.Inodes != (block.Super.InodeBlocks * INODES_PER_BLOCK))
+    if (block.Super.Inodes != (block.Super.InodeBlocks * inodes_per_block))
         return false;
 
     if (block.Super.MapBlocks != (uint32_t)std::ceil((int(block.Super.Blocks) * 1.00) / 100))
         return false;
 
+    if ((block.Super.Features & FEATURE_LAZY_INIT) && (block.Super.InodesInit == 0 || block.Super.InodesInit > block.Super.InodeBlocks))
+        return false;
+
     // define inicio de cada grupo de blocos
+    const uint32_t journal_blocks = (block.Super.Features & FEATURE_JOURNAL) ? block.Super.JournalBlocks : 0;
     startBlockData = startBlockInode + block.Super.InodeBlocks;
     startBlockMapFree = block.Super.Blocks - block.Super.MapBlocks;
+    startBlockJournal = startBlockMapFree - journal_blocks;
+
+    if (journal_blocks && (journal_blocks < JOURNAL_MIN || journal_blocks > startBlockMapFree - startBlockData - 2))
+        return false;
 
     // se fs estiver protegido
     if (block.Super.Protected) {
@@ -190,572 +335,2325 @@ bool FileSystem::mount(Disk* disk) {
 
     disk->mount();
     this->fs_disk = disk;
+    cache.attach(disk);
 
     MetaData = block.Super;
 
-    // Allocate free block bitmap
-    this->free_blocks.resize(MetaData.Blocks, false);
-    this->inode_counter.resize(MetaData.InodeBlocks, 0);
-
-    // Marca blocos de boot, super e inode como ocupados
-    for (uint32_t i = startBlockBoot; i < startBlockInode; i++)
-        free_blocks[i] = true;
-
-    // Percorre Blocos de inodes para marcar blocos de inode e dados em uso
-    for (uint32_t i = startBlockInode; i < startBlockData; i++) {
-
-        // Indice do numero de Inode
-        uint32_t indiceBlocoInode = i - startBlockInode;
-
-        // Le bloco inteiro de Inode
-        disk->read(i, block.Data);
+    // sem FEATURE_LAZY_INIT a tabela de inodes inteira foi zerada na formatacao
+    if (!(MetaData.Features & FEATURE_LAZY_INIT))
+        MetaData.InodesInit = MetaData.InodeBlocks;
 
-        for (uint32_t j = 0; j < INODES_PER_BLOCK; j++) {
-            if (block.Inodes[j].bonds > 0) {
-                this->inode_counter[indiceBlocoInode]++;
+    // transacoes completas do journal voltam ao lugar antes de qualquer leitura de metadados
+    journaled = journal_blocks != 0;
+    if (journaled) {
+        journal.attach(disk, startBlockJournal, journal_blocks);
+        journal.replay();
+        maps_image.clear();
 
-                free_blocks[i] = true;
+        // commit automatico com ate um quarto do log
+        journal_batch = journal_blocks / 4 < JOURNAL_BATCH ? journal_blocks / 4 : JOURNAL_BATCH;
+    }
 
-                for (uint32_t k = 0; k < POINTERS_PER_INODE; k++) {
-                    if (block.Inodes[j].Direct[k]) {
-                        if (block.Inodes[j].Direct[k] < MetaData.Blocks)
-                            free_blocks[block.Inodes[j].Direct[k]] = true;
-                        else
-                            return false;
-                    }
-                }
+    // Allocate free block bitmap (uma fatia por grupo de alocacao)
+    layout_groups();
+    this->free_inodes.resize(MetaData.Inodes);
+    this->inode_counter.assign(MetaData.InodeBlocks, 0);
+    this->inode_table.clear();
+    this->inode_hint = 0;
 
-                if (block.Inodes[j].Indirect) {
-                    if (block.Inodes[j].Indirect < MetaData.Blocks) {
-                        free_blocks[block.Inodes[j].Indirect] = true;
-                        Block indirect;
-                        disk->read(block.Inodes[j].Indirect, indirect.Data);
-                        for (uint32_t k = 0; k < POINTERS_PER_BLOCK; k++) {
-                            if (indirect.Pointers[k] < MetaData.Blocks) {
-                                if (indirect.Pointers[k] != 0)
-                                    free_blocks[indirect.Pointers[k]] = true;
-                            } else
-                                return false;
-                        }
-                    } else
-                        return false;
-                }
-            }
-        }
-    }
+    // desmontado corretamente (ou queda com journal): mapas gravados valem, senao percorre todos os inodes
+    // (imagens antigas com Clean = 1 ou 2 nao gravam o bitmap de inodes ou os descritores de grupo);
+    // mapas rejeitados pelo load_maps tambem caem no scan
+    const bool stored = (MetaData.Clean == CLEAN_MAPS) || (journaled && MetaData.Clean == CLEAN_JOURNAL);
+    const bool maps = stored && load_maps();
+    bool ready = maps || scan_inodes(disk);
 
     // Carrega Diretorio Root
     Block blockINode;
-    disk->read(startBlockInode, blockINode.Data); // Le bloco 0 de iNode
+    cache.read(startBlockInode, blockINode.Data); // Le bloco 0 de iNode
     Inode* node = &blockINode.Inodes[0];          // pega Inode
     uint8_t tipo = node->mode >> 12;
-    if ((node->bonds > 0) && (tipo == 0)) {
+    if (ready && (node->bonds > 0) && (tipo == 0)) {
 
-        curr_dir = node->Direct[0];
         this->mounted = true;
+        curr_dir = open_dir(ROOT_INODE);
+
+        // ate o unmount os mapas em disco ficam desatualizados; com journal acompanham cada commit
+        // a partir dos mapas reconstruidos, gravados aqui, e os metadados ficam retidos ate o commit
+        MetaData.Clean = 0;
+        if (journaled) {
+            if (!maps && save_maps())
+                fs_disk->sync();
+            MetaData.Clean = maps_image.empty() ? 0 : CLEAN_JOURNAL;
+            logged.clear();
+            deferred.clear();
+            cache.retain(true);
+        }
+        write_super();
         return true;
     }
 
+    journal.detach();
+    journaled = false;
+    cache.detach();
+    disk->unmount();
+    this->fs_disk = nullptr;
     return false;
 }
 
-ssize_t FileSystem::create() {
-    if (!mounted)
-        return false;
-
-    Block block;
-    for (uint32_t i = startBlockInode; i < startBlockData; i++) {
-
-        uint32_t indexBlockInode = i - startBlockInode;
-
-        if (inode_counter[indexBlockInode] == INODES_PER_BLOCK)
-            continue;
-        else
-            this->fs_disk->read(i, block.Data);
-
-        for (uint32_t indexINode = 0; indexINode < INODES_PER_BLOCK; indexINode++) {
-            if (block.Inodes[indexINode].bonds == 0) {
-                block.Inodes[indexINode].bonds++;
-                block.Inodes[indexINode].mode = 0b0001000110110110;
-                block.Inodes[indexINode].Size = 0;
-                block.Inodes[indexINode].Indirect = 0;
-                for (int indexDirect = 0; indexDirect < 5; indexDirect++) {
-                    block.Inodes[indexINode].Direct[indexDirect] = 0;
-                }
-                free_blocks[i] = true;
-                inode_counter[indexBlockInode]++;
+void FileSystem::layout_groups() {
+    // grupos alinhados a palavra do mapa: o primeiro comeca na palavra do inicio dos dados
+    const uint32_t base = startBlockData & ~63u;
+    const uint32_t count = (startBlockJournal - base + group_blocks - 1) / group_blocks;
+
+    // inodes divididos na mesma proporcao, em blocos de inode inteiros
+    group_inodes = (MetaData.InodeBlocks + count - 1) / count * inodes_per_block;
+
+    groups.assign(count, {});
+    for (uint32_t g = 0; g < count; g++) {
+        GroupDesc& desc = groups[g];
+        const uint32_t end = (g + 1 < count) ? base + (g + 1) * group_blocks : startBlockJournal;
+        desc.FirstBlock = std::max(base + g * group_blocks, startBlockData);
+        desc.Blocks = end - desc.FirstBlock;
+        desc.FirstInode = std::min(g * group_inodes, MetaData.Inodes);
+        desc.Inodes = std::min((g + 1) * group_inodes, MetaData.Inodes) - desc.FirstInode;
+    }
 
-                this->fs_disk->write(i, block.Data);
+    // fatia 0 tambem cobre superblock e tabela de inodes, a ultima o journal e os blocos de mapa
+    free_blocks.resize(MetaData.Blocks, base, group_blocks, count);
+}
 
-                return (((indexBlockInode)*INODES_PER_BLOCK) + indexINode);
-            }
-        }
+void FileSystem::count_groups(const std::vector<uint32_t>* dirs) {
+    // metadados nunca sao alocados: ocupados no mapa, os contadores dos grupos contam so dados
+    for (uint32_t i = startBlockBoot; i < startBlockData; i++)
+        free_blocks.set(i);
+    for (uint32_t i = startBlockJournal; i < MetaData.Blocks; i++)
+        free_blocks.set(i);
+
+    for (uint32_t g = 0; g < groups.size(); g++) {
+        GroupDesc& desc = groups[g];
+        desc.FreeBlocks = free_blocks.available(g);
+        desc.FreeInodes = free_inodes.count_free(desc.FirstInode, desc.FirstInode + desc.Inodes);
+        if (dirs != nullptr)
+            desc.Directories = (*dirs)[g];
     }
-
-    return -1;
 }
 
-bool FileSystem::load_inode(size_t inumber, Inode* node) {
+bool FileSystem::scan_inodes(Disk* disk) {
 
-    // valida range
-    if (!mounted || (inumber > MetaData.Inodes) || (inumber < 0))
-        return false;
+    // faixas de blocos de inode divididas entre threads (fstream nao aceita leituras concorrentes)
+    // blocos alem de InodesInit nunca foram zerados nem usados
+    const uint32_t total = MetaData.InodesInit;
+    unsigned workers = 1;
+    if (disk->concurrent()) {
+        workers = std::min<uint32_t>(std::thread::hardware_concurrency(), total / SCAN_MIN_BLOCKS);
+        workers = workers < 1 ? 1 : workers > SCAN_MAX_WORKERS ? SCAN_MAX_WORKERS : workers;
+    }
 
-    // encontra o indice do iNode no vetor de inodes
-    uint32_t indiceInodeLocal = inumber / INODES_PER_BLOCK;
+    // cada thread marca seu proprio mapa e conta seus diretorios, unidos no final
+    std::vector<Bitmap> fragments(workers), inodes(workers);
+    std::vector<std::vector<uint32_t>> dirs(workers, std::vector<uint32_t>(groups.size(), 0));
+    std::vector<char> results(workers, false);
+    std::vector<std::exception_ptr> errors(workers);
+    std::vector<std::thread> threads;
+
+    auto work = [&](unsigned w) {
+        const uint32_t first = startBlockInode + (uint64_t)total * w / workers;
+        const uint32_t last = startBlockInode + (uint64_t)total * (w + 1) / workers;
+        try {
+            fragments[w].resize(MetaData.Blocks);
+            inodes[w].resize(MetaData.Inodes);
+            results[w] = scan_range(disk, first, last, &fragments[w], &inodes[w], &dirs[w]);
+        } catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
 
-    // Valida se bloco de iNode nao esta vazio no indice de Inodes
-    if (this->inode_counter[indiceInodeLocal]) {
+    for (unsigned w = 1; w < workers; w++)
+        threads.emplace_back(work, w);
+    work(0);
 
-        Block block;
+    for (std::thread& thread : threads)
+        thread.join();
 
-        // Encontra o Bloco de iNode Correto
-        uint32_t iBlock = indiceInodeLocal + startBlockInode;
+    for (unsigned w = 0; w < workers; w++) {
+        if (errors[w])
+            std::rethrow_exception(errors[w]);
+        if (!results[w])
+            return false;
+        free_blocks.merge(fragments[w]);
+        free_inodes.merge(inodes[w]);
+        for (uint32_t g = 0; w > 0 && g < groups.size(); g++)
+            dirs[0][g] += dirs[w][g];
+    }
 
-        // Encontra o indice de Inode dentro do Bloco encontrado
-        int indexINode = inumber % INODES_PER_BLOCK;
+    count_groups(&dirs[0]);
+    return true;
+}
 
-        // Le o bloco de iNode Inteiro
-        fs_disk->read(iBlock, block.Data);
+bool FileSystem::scan_range(Disk* disk, uint32_t first, uint32_t last, Bitmap* used, Bitmap* live, std::vector<uint32_t>* dirs) {
+    // bloco de indirecao (ou folha de extents) ainda a ser lido
+    struct Table {
+        uint32_t blocknum; // bloco a ler
+        int depth;         // niveis ate os dados
+        bool leaf;         // folha de extents
+    };
+
+    std::vector<char> buffer(SCAN_BATCH * block_size);
+    std::vector<Table> tables;
+
+    // le blocos em lotes vetorizados, sem o cache (nao e compartilhado entre threads)
+    auto each_block = [&](const std::vector<uint32_t>& numbers, auto&& visit) {
+        for (size_t i = 0; i < numbers.size(); i += SCAN_BATCH) {
+            const size_t count = std::min<size_t>(SCAN_BATCH, numbers.size() - i);
+
+            if (!disk->mapped()) {
+                std::vector<Disk::Request> requests;
+                for (size_t k = 0; k < count; k++)
+                    requests.push_back({(int)numbers[i + k], &buffer[k * block_size]});
+                disk->readv(requests);
+            }
 
-        // Se iNode estiver valido para uso carregar na variavel de retorno por ref
-        if (block.Inodes[indexINode].bonds > 0) {
-            *node = block.Inodes[indexINode];
-            return true;
+            for (size_t k = 0; k < count; k++) {
+                const char* data = disk->mapped() ? disk->span(numbers[i + k]).data() : &buffer[k * block_size];
+                if (!visit(i + k, (const Block*)data))
+                    return false;
+            }
         }
-    }
-
-    // iNode não é Valido
-    return false;
-}
+        return true;
+    };
 
-// Remove inode ----------------------------------------------------------------
+    auto mark_extent = [&](const Extent& extent) {
+        if (extent.Start == 0 || (uint64_t)extent.Start + extent.Length > MetaData.Blocks)
+            return false;
+        for (uint32_t k = 0; k < extent.Length; k++)
+            used->set(extent.Start + k);
+        return true;
+    };
 
-bool FileSystem::remove(size_t inumber) {
+    // Percorre Blocos de inodes para marcar blocos de inode e dados em uso
+    std::vector<uint32_t> numbers;
+    for (uint32_t i = first; i < last; i++)
+        numbers.push_back(i);
 
-    if (!mounted)
-        return false;
+    bool ok = each_block(numbers, [&](size_t index, const Block* inodes) {
+        const uint32_t i = numbers[index];
 
-    Inode node;
+        // Indice do numero de Inode
+        uint32_t indiceBlocoInode = i - startBlockInode;
 
-    if (load_inode(inumber, &node)) {
-        node.bonds--;
-        node.Size = 0;
+        for (uint32_t j = 0; j < inodes_per_block; j++) {
+            const Inode& node = inodes->Inodes[j];
+            if (node.bonds == 0)
+                continue;
+
+            this->inode_counter[indiceBlocoInode]++;
+            live->set(indiceBlocoInode * inodes_per_block + j);
+            used->set(i);
+            if ((node.mode >> 12) == 0)
+                (*dirs)[inode_group(indiceBlocoInode * inodes_per_block + j)]++;
+
+            // dados inline: nenhum bloco a marcar
+            if (node.mode & MODE_INLINE)
+                continue;
+
+            if (node.mode & MODE_EXTENTS) {
+                for (uint32_t k = 0; k < node.Count && k < EXTENTS_PER_INODE; k++) {
+                    if (node.Depth > 0)
+                        tables.push_back({node.Extents[k].Start, 1, true});
+                    else if (!mark_extent(node.Extents[k]))
+                        return false;
+                }
+                continue;
+            }
 
-        uint32_t indiceInodeLocal = inumber / INODES_PER_BLOCK;
-        uint32_t iBlock = indiceInodeLocal + startBlockInode;
+            for (uint32_t k = 0; k < POINTERS_PER_INODE; k++) {
+                if (node.Direct[k]) {
+                    if (node.Direct[k] < MetaData.Blocks)
+                        used->set(node.Direct[k]);
+                    else
+                        return false;
+                }
+            }
 
-        if (!(--inode_counter[indiceInodeLocal])) {
-            this->free_blocks[iBlock] = false;
+            // blocos de indirecao (simples, dupla, tripla) lidos depois, em lote por nivel
+            const uint32_t roots[] = {node.Indirect, node.Indirect2, node.Indirect3};
+            for (int depth = 1; depth <= 3; depth++) {
+                if (roots[depth - 1])
+                    tables.push_back({roots[depth - 1], depth, false});
+            }
         }
 
-        for (uint32_t i = 0; i < POINTERS_PER_INODE; i++) {
-            this->free_blocks[node.Direct[i]] = false;
-            node.Direct[i] = 0;
+        return true;
+    });
+
+    while (ok && !tables.empty()) {
+        // ordenados por bloco: vizinhos viram uma unica leitura
+        std::sort(tables.begin(), tables.end(), [](const Table& a, const Table& b) { return a.blocknum < b.blocknum; });
+
+        numbers.clear();
+        for (const Table& table : tables) {
+            if (table.blocknum == 0 || table.blocknum >= MetaData.Blocks)
+                return false;
+            used->set(table.blocknum);
+            numbers.push_back(table.blocknum);
         }
 
-        if (node.Indirect) {
-            Block indirect;
-            fs_disk->read(node.Indirect, indirect.Data);
-            this->free_blocks[node.Indirect] = false;
-            node.Indirect = 0;
+        std::vector<Table> next;
+        ok = each_block(numbers, [&](size_t index, const Block* block) {
+            const Table& table = tables[index];
 
-            for (uint32_t i = 0; i < POINTERS_PER_BLOCK; i++) {
-                if (indirect.Pointers[i])
-                    this->free_blocks[indirect.Pointers[i]] = false;
+            if (table.leaf) {
+                for (uint32_t k = 0; k < std::min(block->Leaf.Count, extents_per_block); k++) {
+                    if (!mark_extent(block->Leaf.Extents[k]))
+                        return false;
+                }
+                return true;
             }
-        }
 
-        Block block;
-        fs_disk->read(iBlock, block.Data);
-        block.Inodes[inumber % INODES_PER_BLOCK] = node;
-        fs_disk->write(iBlock, block.Data);
+            for (uint32_t k = 0; k < pointers_per_block; k++) {
+                const uint32_t pointer = block->Pointers[k];
+                if (!pointer)
+                    continue;
+
+                if (table.depth > 1)
+                    next.push_back({pointer, table.depth - 1, false});
+                else if (pointer < MetaData.Blocks)
+                    used->set(pointer);
+                else
+                    return false;
+            }
+            return true;
+        });
 
-        return true;
+        tables.swap(next);
     }
 
-    return false;
+    return ok;
 }
 
-// Inode stat ------------------------------------------------------------------
+bool FileSystem::load_maps() {
+    const size_t words = (MetaData.Blocks + 63) / 64;
+    const size_t counters_bytes = MetaData.InodeBlocks * sizeof(uint16_t);
+    const size_t inode_words = (MetaData.Inodes + 63) / 64;
+    const size_t groups_pos = words * sizeof(uint64_t) + counters_bytes + inode_words * sizeof(uint64_t);
+    const size_t bytes = groups_pos + groups.size() * sizeof(GroupDesc);
+    if (bytes > (size_t)MetaData.MapBlocks * block_size)
+        return false;
 
-ssize_t FileSystem::stat(size_t inumber) {
-    if (!mounted)
-        return -1;
+    // mapa de blocos, contadores de inode, mapa de inodes e descritores de grupo, lidos num unico lote
+    std::vector<char> buffer(MetaData.MapBlocks * block_size);
+    std::vector<Disk::Request> requests;
+    for (uint32_t i = 0; i < MetaData.MapBlocks; i++)
+        requests.push_back({(int)(startBlockMapFree + i), &buffer[i * block_size]});
+    cache.readv(requests);
+
+    // descritores gravados com outra divisao em grupos nao servem
+    std::vector<GroupDesc> stored(groups.size());
+    memcpy(stored.data(), buffer.data() + groups_pos, groups.size() * sizeof(GroupDesc));
+    for (uint32_t g = 0; g < groups.size(); g++) {
+        if (stored[g].FirstBlock != groups[g].FirstBlock || stored[g].Blocks != groups[g].Blocks ||
+            stored[g].FirstInode != groups[g].FirstInode || stored[g].Inodes != groups[g].Inodes)
+            return false;
+    }
+    groups = stored;
 
-    Inode node;
+    free_blocks.assign((const uint64_t*)buffer.data(), MetaData.Blocks);
 
-    if (load_inode(inumber, &node))
-        return node.Size;
+    const uint16_t* counters = (const uint16_t*)(buffer.data() + words * sizeof(uint64_t));
+    for (uint32_t i = 0; i < MetaData.InodeBlocks; i++)
+        inode_counter[i] = counters[i];
 
-    return -1;
+    // palavras do mapa de inodes podem ficar desalinhadas depois dos contadores
+    std::vector<uint64_t> inode_map(inode_words);
+    memcpy(inode_map.data(), buffer.data() + words * sizeof(uint64_t) + counters_bytes, inode_words * sizeof(uint64_t));
+    free_inodes.assign(inode_map.data(), MetaData.Inodes);
+
+    // base de comparacao do proximo commit do journal
+    if (journaled)
+        maps_image.swap(buffer);
+
+    count_groups(nullptr);
+    return true;
 }
 
-// Read from inode -------------------------------------------------------------
+std::vector<char> FileSystem::map_image() {
+    const std::vector<uint64_t>& words = free_blocks.data();
+    const std::vector<uint64_t>& inode_map = free_inodes.data();
+    const size_t counters_bytes = inode_counter.size() * sizeof(uint16_t);
+    const size_t groups_pos = (words.size() + inode_map.size()) * sizeof(uint64_t) + counters_bytes;
+    const size_t bytes = groups_pos + groups.size() * sizeof(GroupDesc);
+    if (bytes > (size_t)MetaData.MapBlocks * block_size)
+        return {};
 
-void FileSystem::read_helper(uint32_t blocknum, int offset, size_t* length, char** data, char** ptr) {
-    fs_disk->read(blocknum, *ptr);
-    *data += offset;
-    *ptr += Disk::BLOCK_SIZE;
-    *length -= (Disk::BLOCK_SIZE - offset);
+    for (uint32_t g = 0; g < groups.size(); g++)
+        groups[g].FreeBlocks = free_blocks.available(g);
 
-    return;
-}
+    std::vector<char> buffer(MetaData.MapBlocks * block_size, 0);
+    memcpy(buffer.data(), words.data(), words.size() * sizeof(uint64_t));
 
-ssize_t FileSystem::read(size_t inumber, char* data, size_t length, size_t offset) {
-    if (!mounted)
-        return -1;
+    uint16_t* counters = (uint16_t*)(buffer.data() + words.size() * sizeof(uint64_t));
+    for (size_t i = 0; i < inode_counter.size(); i++)
+        counters[i] = inode_counter[i];
 
-    int size_inode = stat(inumber);
+    memcpy(buffer.data() + words.size() * sizeof(uint64_t) + counters_bytes, inode_map.data(), inode_map.size() * sizeof(uint64_t));
+    memcpy(buffer.data() + groups_pos, groups.data(), groups.size() * sizeof(GroupDesc));
+    return buffer;
+}
 
-    if ((int)offset >= size_inode)
-        return 0;
-    else if (length + (int)offset > size_inode)
-        length = size_inode - offset;
+bool FileSystem::save_maps() {
+    std::vector<char> buffer = map_image();
+    if (buffer.empty())
+        return false;
 
-    Inode node;
+    std::vector<Disk::Request> requests;
+    for (uint32_t i = 0; i < MetaData.MapBlocks; i++)
+        requests.push_back({(int)(startBlockMapFree + i), &buffer[i * block_size]});
+    cache.writev(requests);
 
-    char* ptr = data;
-    int to_read = length;
+    // proximo commit do journal so grava os blocos alterados depois desta imagem
+    if (journaled)
+        maps_image.swap(buffer);
+    return true;
+}
 
-    if (load_inode(inumber, &node)) {
-        if (offset < POINTERS_PER_INODE * Disk::BLOCK_SIZE) {
-            uint32_t direct_node = offset / Disk::BLOCK_SIZE;
-            offset %= Disk::BLOCK_SIZE;
+void FileSystem::stage_maps() {
+    std::vector<char> buffer = map_image();
+    if (buffer.empty() || buffer.size() != maps_image.size())
+        return;
 
-            if (node.Direct[direct_node]) {
-                read_helper(node.Direct[direct_node++], offset, &length, &data, &ptr);
-                while (length > 0 && direct_node < POINTERS_PER_INODE && node.Direct[direct_node]) {
-                    read_helper(node.Direct[direct_node++], 0, &length, &data, &ptr);
-                }
+    // liberacoes adiadas ja valem no disco: depois de uma queda o log e esvaziado no mount
+    uint64_t* words = (uint64_t*)buffer.data();
+    for (uint32_t blocknum : deferred)
+        words[blocknum / 64] &= ~(1ull << (blocknum % 64));
 
-                if (length <= 0)
-                    return to_read;
-                else {
-                    if (direct_node == POINTERS_PER_INODE && node.Indirect) {
-                        Block indirect;
-                        fs_disk->read(node.Indirect, indirect.Data);
-
-                        for (uint32_t i = 0; i < POINTERS_PER_BLOCK; i++) {
-                            if (indirect.Pointers[i] && length > 0) {
-                                read_helper(indirect.Pointers[i], 0, &length, &data, &ptr);
-                            } else
-                                break;
-                        }
-
-                        if (length <= 0)
-                            return to_read;
-                        else {
-                            return (to_read - length);
-                        }
-                    } else {
-                        return (to_read - length);
-                    }
-                }
-            } else {
-                return 0;
-            }
-        } else {
-            if (node.Indirect) {
-                offset -= (POINTERS_PER_INODE * Disk::BLOCK_SIZE);
-                uint32_t indirect_node = offset / Disk::BLOCK_SIZE;
-                offset %= Disk::BLOCK_SIZE;
+    for (uint32_t i = 0; i < MetaData.MapBlocks; i++) {
+        const size_t pos = (size_t)i * block_size;
+        if (memcmp(&buffer[pos], &maps_image[pos], block_size) != 0)
+            cache.write(startBlockMapFree + i, &buffer[pos]);
+    }
 
-                Block indirect;
-                fs_disk->read(node.Indirect, indirect.Data);
+    maps_image.swap(buffer);
+}
 
-                if (indirect.Pointers[indirect_node] && length > 0) {
-                    read_helper(indirect.Pointers[indirect_node++], offset, &length, &data, &ptr);
-                }
+bool FileSystem::commit() {
+    // inodes sujos e mapas entram na mesma transacao que os blocos ja retidos
+    flush_inodes();
+    stage_maps();
 
-                for (uint32_t i = indirect_node; i < POINTERS_PER_BLOCK; i++) {
-                    if (indirect.Pointers[i] && length > 0) {
-                        read_helper(indirect.Pointers[i], 0, &length, &data, &ptr);
-                    } else
-                        break;
-                }
+    std::vector<Disk::Request> blocks = cache.retained_blocks();
+    if (blocks.empty())
+        return false;
 
-                if (length <= 0)
-                    return to_read;
-                else {
-                    return (to_read - length);
-                }
-            } else {
-                return 0;
-            }
-        }
+    if (!journal.fits(blocks.size()))
+        checkpoint();
+
+    if (journal.fits(blocks.size())) {
+        journal.commit(blocks);
+        for (const Disk::Request& request : blocks)
+            logged.insert(request.blocknum);
+        cache.release();
+        return true;
     }
 
-    return -1;
+    // transacao maior que o log: grava no lugar, com os mapas invalidados ate o fim
+    MetaData.Clean = 0;
+    write_super();
+    cache.release();
+    cache.sync();
+    MetaData.Clean = CLEAN_JOURNAL;
+    write_super();
+    return true;
 }
 
-uint32_t FileSystem::allocate_block() {
-    if (!mounted)
-        return 0;
+void FileSystem::commit_due() {
+    if (journaled && cache.retained() >= journal_batch)
+        commit();
+}
 
-    // Procura bloco livre
-    for (uint32_t i = startBlockData; i < startBlockMapFree; i++) {
-        if (free_blocks[i] == 0) {
-            free_blocks[i] = true;
-            return i;
-        }
-    }
+void FileSystem::checkpoint() {
+    // blocos das transacoes no lugar e no disco antes de esvaziar o log
+    cache.flush();
+    fs_disk->sync();
+    journal.reset();
+    logged.clear();
+
+    for (uint32_t blocknum : deferred)
+        free_blocks.clear(blocknum);
+    deferred.clear();
+}
+
+void FileSystem::release_block(uint32_t blocknum) {
+    if (journaled && logged.count(blocknum))
+        deferred.push_back(blocknum);
+    else
+        free_blocks.clear(blocknum);
+}
+
+void FileSystem::write_super() {
+    Block block;
+    memset(block.Data, 0, block_size);
+    block.Super = MetaData;
 
-    return 0;
+    // write-through: o estado Clean precisa chegar ao disco imediatamente
+    cache.writev({{startBlockSuper, block.Data}});
 }
 
-bool FileSystem::check_allocation(Inode* node, int read, int orig_offset, uint32_t& blocknum, bool write_indirect, Block indirect) {
+bool FileSystem::unmount() {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
     if (!mounted)
         return false;
 
-    if (!blocknum) {
-        blocknum = allocate_block();
-        if (!blocknum) {
-            node->Size = read + orig_offset;
-            if (write_indirect)
-                fs_disk->write(node->Indirect, indirect.Data);
-            return false;
-        }
+    // arquivos ainda abertos (e o diretorio corrente) sao fechados
+    while (!handles.empty())
+        close_handle(handles.back().get());
+    curr_dir = nullptr;
+    directories.clear();
+    dcache.clear();
+
+    // dados e mapas no disco antes de marcar o fs como limpo; dados adiados perdidos sao reportados,
+    // mas a desmontagem segue
+    const bool flushed = flush_delayed() && delayed_errors.empty();
+    delayed_errors.clear();
+    flush_inodes();
+    if (journaled) {
+        commit();
+        checkpoint();
+        cache.retain(false);
+        journaled = false;
+    }
+    cache.flush();
+    if (save_maps()) {
+        fs_disk->sync();
+        MetaData.Clean = CLEAN_MAPS;
+        write_super();
     }
 
-    return true;
+    cache.sync();
+    cache.detach();
+    journal.detach();
+    fs_disk->unmount();
+    this->inode_table.clear();
+    this->fs_disk = nullptr;
+    this->mounted = false;
+    delayed_room = 0;
+    return flushed;
 }
 
-ssize_t FileSystem::write_ret(size_t inumber, Inode* node, int ret) {
+bool FileSystem::sync() {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
     if (!mounted)
-        return -1;
+        return false;
 
-    // encocntra bloco de posicao do inode correspondente
-    int i = (inumber / INODES_PER_BLOCK) + startBlockInode;
-    int j = inumber % INODES_PER_BLOCK;
+    const bool flushed = flush_delayed() && delayed_errors.empty();
+    delayed_errors.clear();
 
-    // Le o bloco inteiro e grava os novos dados do inode em sua posicao
-    Block block;
-    fs_disk->read(i, block.Data);
-    block.Inodes[j] = *node;
-    fs_disk->write(i, block.Data);
+    // com journal o commit ja deixa os metadados no disco; blocos de dados foram gravados antes dele
+    if (journaled && commit())
+        return flushed;
 
-    // TODO: melhorar
-    return (ssize_t)ret;
+    flush_inodes();
+    cache.sync();
+    return flushed;
 }
 
-void FileSystem::read_buffer(int offset, int* read, int length, char* data, uint32_t blocknum) {
+ssize_t FileSystem::create() {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    commit_due();
     if (!mounted)
-        return;
-
-    char* ptr = (char*)calloc(Disk::BLOCK_SIZE, sizeof(char));
-
-    for (int i = offset; i < (int)Disk::BLOCK_SIZE && *read < length; i++) {
-        ptr[i] = data[*read];
-        *read = *read + 1;
-    }
-    fs_disk->write(blocknum, ptr);
-
-    free(ptr);
+        return -1;
 
-    return;
+    // sem nome: fica no grupo do diretorio corrente
+    return create_inode(inode_group(curr_dir ? curr_dir->Inumber : ROOT_INODE));
 }
 
-// Write to inode --------------------------------------------------------------
-
-ssize_t FileSystem::write(size_t inumber, char* data, size_t length, size_t offset) {
+ssize_t FileSystem::create_inode(uint32_t group) {
     if (!mounted)
         return -1;
 
-    Inode node;
-    Block indirect;
-    int read = 0;
-    int orig_offset = offset;
+    // primeiro inode livre do grupo a partir do hint (dando a volta no grupo), senao nos grupos seguintes
+    size_t inumber = MetaData.Inodes;
+    for (uint32_t k = 0; k < groups.size() && inumber == MetaData.Inodes; k++) {
+        const GroupDesc& desc = groups[(group + k) % groups.size()];
+        if (desc.FreeInodes == 0)
+            continue;
 
-    // verifica se arquivo é maior do que a capacidade total maxima de armazenamento
-    if (length + offset > (POINTERS_PER_BLOCK + POINTERS_PER_INODE) * Disk::BLOCK_SIZE) {
-        return -1;
+        const size_t end = desc.FirstInode + desc.Inodes;
+        const size_t from = (inode_hint > desc.FirstInode && inode_hint < end) ? inode_hint : desc.FirstInode;
+        size_t found = free_inodes.find_free(from, end);
+        if (found == end)
+            found = free_inodes.find_free(desc.FirstInode, from);
+        if (found < end && !free_inodes.test(found))
+            inumber = found;
     }
 
-    if (!load_inode(inumber, &node)) {
-        // entradas consecutivas com offset != 0 inode sera atualizado
-        node.bonds++;
-        node.Size = length + offset;
-        for (uint32_t ii = 0; ii < POINTERS_PER_INODE; ii++) {
-            node.Direct[ii] = 0;
-        }
-        node.Indirect = 0;
-        inode_counter[inumber / INODES_PER_BLOCK]++;
-        free_blocks[inumber / INODES_PER_BLOCK + 1] = true;
-    } else {
-        // primeira entrada com offset 0, inode sera preenchido pela primeira vez
-        node.Size = std::max((size_t)node.Size, length + offset);
+    if (inumber == MetaData.Inodes)
+        return -1;
+
+    const uint32_t indexBlockInode = inumber / inodes_per_block;
+    if (indexBlockInode >= MetaData.InodesInit) {
+        Block block;
+        init_inodes(indexBlockInode + 1, &block);
     }
 
-    if (offset < POINTERS_PER_INODE * Disk::BLOCK_SIZE) {
-        // arquivo cabe em 1 a 5 blocos (sem indireção)
-        int direct_node = offset / Disk::BLOCK_SIZE;
-        offset %= Disk::BLOCK_SIZE;
+    // slot livre e sobrescrito inteiro: nenhum bloco de inode lido, gravado pelo cache de inodes
+    Inode* node = acquire_inode(inumber, true);
+    memset(node, 0, sizeof(Inode));
+    node->bonds++;
+    node->mode = 0b0001000110110110;
+    if (MetaData.Features & FEATURE_EXTENTS)
+        node->mode |= MODE_EXTENTS;
+    free_inodes.set(inumber);
+    inode_counter[indexBlockInode]++;
+    groups[inode_group(inumber)].FreeInodes--;
+    inode_hint = inumber + 1;
+
+    release_inode(inumber, true);
+
+    return inumber;
+}
+
+uint32_t FileSystem::dir_group(uint32_t parent) {
+    const uint32_t home = inode_group(parent);
+
+    uint64_t inodes = 0, blocks = 0;
+    for (uint32_t g = 0; g < groups.size(); g++) {
+        groups[g].FreeBlocks = free_blocks.available(g);
+        inodes += groups[g].FreeInodes;
+        blocks += groups[g].FreeBlocks;
+    }
+    const uint64_t avg_inodes = inodes / groups.size();
+    const uint64_t avg_blocks = blocks / groups.size();
+
+    auto roomy = [&](const GroupDesc& desc) {
+        return desc.FreeInodes > 0 && desc.FreeInodes >= avg_inodes && desc.FreeBlocks >= avg_blocks;
+    };
+
+    if (parent != ROOT_INODE && roomy(groups[home]))
+        return home;
+
+    // lazy: apenas o primeiro grupo com a tabela de inodes ainda nao zerada e candidato
+    uint32_t best = home;
+    bool found = false, fresh = false;
+    for (uint32_t g = 0; g < groups.size(); g++) {
+        const GroupDesc& desc = groups[g];
+        if (desc.FirstInode / inodes_per_block >= MetaData.InodesInit) {
+            if (fresh)
+                continue;
+            fresh = true;
+        }
 
-        if (!check_allocation(&node, read, orig_offset, node.Direct[direct_node], false, indirect)) {
-            // falhou em alocar todo o espaço grava apenas o que conseguiu
-            return write_ret(inumber, &node, read);
+        if (roomy(desc) && (!found || desc.Directories < groups[best].Directories)) {
+            best = g;
+            found = true;
         }
-        // copia dados do buffer de entrada para o bloco no fs (direct_node)
-        read_buffer(offset, &read, length, data, node.Direct[direct_node++]);
+    }
 
-        if (read == length)
-            // atualiza inode com dados gravados e sai da funcao
-            return write_ret(inumber, &node, length);
-        else {
+    return best;
+}
 
-            // continua a escrever nos blocos diretos
-            for (int i = direct_node; i < (int)POINTERS_PER_INODE; i++) {
-                if (!check_allocation(&node, read, orig_offset, node.Direct[direct_node], false, indirect)) {
-                    return write_ret(inumber, &node, read);
-                }
-                // copia dados do buffer de entrada para o bloco no fs (direct_node)
-                read_buffer(0, &read, length, data, node.Direct[direct_node++]);
+void FileSystem::init_inodes(uint32_t count, Block* block) {
+    memset(block->Data, 0, block_size);
 
-                // dados copiados em todas as passadas, atualiza o inode
-                if (read == length)
-                    return write_ret(inumber, &node, length);
-            }
+    // write-through: o superblock so pode cobrir blocos ja zerados no disco
+    std::vector<Disk::Request> requests;
+    for (uint32_t i = MetaData.InodesInit; i < count; i++)
+        requests.push_back({(int)(startBlockInode + i), block->Data});
+    cache.writev(requests);
 
-            // se indirect ja foi instanciado
-            if (node.Indirect)
-                fs_disk->read(node.Indirect, indirect.Data);
-            else {
+    MetaData.InodesInit = count;
+    write_super();
+}
 
-                // Aloca e formata bloco de indirecao
-                if (!check_allocation(&node, read, orig_offset, node.Indirect, false, indirect)) {
-                    return write_ret(inumber, &node, read);
-                }
-                fs_disk->read(node.Indirect, indirect.Data);
+FileSystem::Inode* FileSystem::acquire_inode(size_t inumber, bool fresh) {
 
-                for (int i = 0; i < (int)POINTERS_PER_BLOCK; i++) {
-                    indirect.Pointers[i] = 0;
-                }
-            }
+    // valida range
+    if (!mounted || (inumber >= MetaData.Inodes))
+        return nullptr;
 
-            for (int j = 0; j < (int)POINTERS_PER_BLOCK; j++) {
-                if (!check_allocation(&node, read, orig_offset, indirect.Pointers[j], true, indirect)) {
-                    return write_ret(inumber, &node, read);
-                }
-                read_buffer(0, &read, length, data, indirect.Pointers[j]);
+    std::unique_lock<std::mutex> table(table_lock);
+    auto it = inode_table.find(inumber);
 
-                if (read == length) {
-                    fs_disk->write(node.Indirect, indirect.Data);
-                    return write_ret(inumber, &node, length);
-                }
-            }
+    // outra thread lendo o bloco deste inode: espera a copia (ou a falha, que remove a entrada)
+    while (it != inode_table.end() && it->second.loading) {
+        inode_loaded.wait(table);
+        it = inode_table.find(inumber);
+    }
 
-            fs_disk->write(node.Indirect, indirect.Data);
-            return write_ret(inumber, &node, read);
-        }
-    } else {
-        offset -= (Disk::BLOCK_SIZE * POINTERS_PER_INODE);
-        int indirect_node = offset / Disk::BLOCK_SIZE;
-        offset %= Disk::BLOCK_SIZE;
-
-        // Se Node indirect ja esta instanciado ler bloco de dados do mesmo
-        if (node.Indirect)
-            fs_disk->read(node.Indirect, indirect.Data);
-        else {
-            // primeira entrado do node indirect alocar bloco para indirect
-            if (!check_allocation(&node, read, orig_offset, node.Indirect, false, indirect)) {
-                return write_ret(inumber, &node, read);
+    if (it == inode_table.end()) {
+        // encontra o indice do iNode no vetor de inodes
+        uint32_t indiceInodeLocal = inumber / inodes_per_block;
+
+        CachedInode entry;
+        memset(&entry.node, 0, sizeof(Inode));
+        it = inode_table.emplace(inumber, entry).first;
+
+        // bloco de iNode vazio no indice de Inodes nao precisa ser lido; o bloco e lido sem o
+        // table_lock, a entrada presa (refs) e marcada loading nao sai do cache
+        if (!fresh && this->inode_counter[indiceInodeLocal]) {
+            CachedInode& loading = it->second;
+            loading.loading = true;
+            loading.refs++;
+            table.unlock();
+
+            Block block;
+            try {
+                cache.read(indiceInodeLocal + startBlockInode, block.Data);
+            } catch (...) {
+                table.lock();
+                inode_table.erase(inumber);
+                inode_loaded.notify_all();
+                throw;
             }
 
-            // le bloco com dados do indirect
-            fs_disk->read(node.Indirect, indirect.Data);
+            table.lock();
+            loading.node = block.Inodes[inumber % inodes_per_block];
+            loading.loading = false;
+            inode_loaded.notify_all();
 
-            // Limpa ponteiros dentro de indirect
-            for (int i = 0; i < (int)POINTERS_PER_BLOCK; i++) {
-                indirect.Pointers[i] = 0;
-            }
+            if (inode_table.size() > inode_capacity)
+                trim_inodes();
+            return &loading.node;
         }
+    }
 
-        // Aloca novo bloco para dados e coloca indice do iNode no vetor de indirect
-        if (!check_allocation(&node, read, orig_offset, indirect.Pointers[indirect_node], true, indirect)) {
-            return write_ret(inumber, &node, read);
-        }
+    it->second.refs++;
 
-        // escreve dados no bloco
-        read_buffer(offset, &read, length, data, indirect.Pointers[indirect_node++]);
+    if (inode_table.size() > inode_capacity)
+        trim_inodes();
 
-        if (read == length) {
-            // se dados cabem escreve bloco do indirect e atualiza iNode do arquivo
-            fs_disk->write(node.Indirect, indirect.Data);
-            return write_ret(inumber, &node, length);
-        } else {
-            for (int j = indirect_node; j < (int)POINTERS_PER_BLOCK; j++) {
-                // Aloca novo bloco
-                if (!check_allocation(&node, read, orig_offset, indirect.Pointers[j], true, indirect)) {
-                    return write_ret(inumber, &node, read);
-                }
-                // escreve dados no bloco
-                read_buffer(0, &read, length, data, indirect.Pointers[j]);
+    return &it->second.node;
+}
 
-                if (read == length) {
-                    fs_disk->write(node.Indirect, indirect.Data);
-                    return write_ret(inumber, &node, length);
-                }
-            }
+void FileSystem::release_inode(size_t inumber, bool dirty) {
+    std::lock_guard<std::mutex> table(table_lock);
+    CachedInode& entry = inode_table.at(inumber);
+    entry.refs--;
+    entry.dirty = entry.dirty || dirty;
+}
 
-            fs_disk->write(node.Indirect, indirect.Data);
-            return write_ret(inumber, &node, read);
-        }
+void FileSystem::flush_inodes(bool pinned) {
+    // inode preso pode estar sendo alterado pelo escritor que o tem
+    std::vector<uint32_t> dirty;
+    for (auto& [inumber, entry] : inode_table) {
+        if (entry.dirty && (pinned || entry.refs == 0))
+            dirty.push_back(inumber);
     }
 
-    return -1;
-}
+    // inodes do mesmo bloco seguem numa unica escrita
+    std::sort(dirty.begin(), dirty.end());
 
-// FIXME: abaixo sera em outra classe
+    Block block;
+    for (size_t i = 0; i < dirty.size();) {
+        const uint32_t iBlock = dirty[i] / inodes_per_block + startBlockInode;
+        cache.read(iBlock, block.Data);
+
+        for (; i < dirty.size() && dirty[i] / inodes_per_block + startBlockInode == iBlock; i++) {
+            CachedInode& entry = inode_table.at(dirty[i]);
+            block.Inodes[dirty[i] % inodes_per_block] = entry.node;
+            entry.dirty = false;
+        }
 
-// Necessario para criar arquivo
+        cache.write(iBlock, block.Data);
+    }
+}
+
+void FileSystem::trim_inodes() {
+    auto evict = [this]() {
+        for (auto it = inode_table.begin(); it != inode_table.end() && inode_table.size() > inode_capacity;) {
+            if (it->second.refs == 0 && !it->second.dirty)
+                it = inode_table.erase(it);
+            else
+                it++;
+        }
+    };
+
+    evict();
+
+    // restaram apenas sujos: grava todos os soltos de uma vez e tenta de novo
+    if (inode_table.size() > inode_capacity) {
+        flush_inodes(false);
+        evict();
+    }
+}
+
+bool FileSystem::load_inode(size_t inumber, Inode* node) {
+    Inode* cached = acquire_inode(inumber);
+    if (cached == nullptr)
+        return false;
+
+    *node = *cached;
+    release_inode(inumber, false);
+
+    // iNode valido para uso
+    return node->bonds > 0;
+}
+
+// Remove inode ----------------------------------------------------------------
+
+bool FileSystem::remove(size_t inumber) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    commit_due();
+    return remove_inode(inumber);
+}
+
+bool FileSystem::remove_inode(size_t inumber) {
+    if (!mounted)
+        return false;
+
+    Inode* cached = acquire_inode(inumber);
+    if (cached == nullptr)
+        return false;
+
+    Inode& node = *cached;
+
+    if (node.bonds > 0) {
+        node.bonds--;
+        node.Size = 0;
+
+        // escrita adiada de arquivo removido nunca chega ao disco
+        drop_delayed(inumber);
+
+        // blocos liberados saem do mapa dos arquivos abertos
+        for (std::unique_ptr<FileHandle>& handle : handles) {
+            if (handle->Inumber == inumber)
+                handle->blocks.clear();
+        }
+
+        uint32_t indiceInodeLocal = inumber / inodes_per_block;
+
+        --inode_counter[indiceInodeLocal];
+        this->free_inodes.clear(inumber);
+
+        GroupDesc& desc = groups[inode_group(inumber)];
+        desc.FreeInodes++;
+        if ((node.mode >> 12) == 0)
+            desc.Directories--;
+
+        if (node.mode & MODE_INLINE) {
+            memset(node.Inline, 0, INLINE_BYTES);
+            node.mode &= ~MODE_INLINE;
+        } else if (node.mode & MODE_EXTENTS) {
+            std::vector<Extent> extents;
+            std::vector<uint32_t> leaves;
+            list_extents(fs_disk, &node, extents, leaves);
+
+            for (const Extent& extent : extents) {
+                for (uint32_t k = 0; k < extent.Length; k++)
+                    release_block(extent.Start + k);
+            }
+
+            for (uint32_t leaf : leaves)
+                release_block(leaf);
+
+            node.Count = 0;
+            node.Depth = 0;
+        } else {
+            for (uint32_t i = 0; i < POINTERS_PER_INODE; i++) {
+                if (node.Direct[i])
+                    release_block(node.Direct[i]);
+                node.Direct[i] = 0;
+            }
+
+            std::vector<uint32_t> tables, blocks;
+            list_indirect(fs_disk, node.Indirect, 1, tables, blocks);
+            list_indirect(fs_disk, node.Indirect2, 2, tables, blocks);
+            list_indirect(fs_disk, node.Indirect3, 3, tables, blocks);
+
+            for (uint32_t blocknum : tables)
+                release_block(blocknum);
+
+            for (uint32_t blocknum : blocks)
+                release_block(blocknum);
+
+            node.Indirect = 0;
+            node.Indirect2 = 0;
+            node.Indirect3 = 0;
+        }
+
+        release_inode(inumber, true);
+        return true;
+    }
+
+    release_inode(inumber, false);
+    return false;
+}
+
+// Inode stat ------------------------------------------------------------------
+
+ssize_t FileSystem::stat(size_t inumber) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    if (!mounted)
+        return -1;
+
+    std::shared_lock<std::shared_mutex> lock(inode_lock(inumber));
+    Inode node;
+
+    if (!load_inode(inumber, &node))
+        return -1;
+
+    // escrita adiada ja conta no tamanho
+    std::lock_guard<std::mutex> table(table_lock);
+    auto it = delayed.find(inumber);
+    if (it != delayed.end())
+        return std::max<size_t>(node.Size, it->second.offset + it->second.data.size());
+
+    return node.Size;
+}
+
+// Read from inode -------------------------------------------------------------
+
+void FileSystem::read_helper(uint32_t blocknum, int offset, size_t* length, char** ptr) {
+    const size_t count = std::min(block_size - offset, *length);
+
+    std::span<char> mapped = fs_disk->span(blocknum);
+    if (!mapped.empty()) {
+        // copia direto do mapeamento para o buffer do usuario
+        memcpy(*ptr, mapped.data() + offset, count);
+    } else if (count == block_size) {
+        cache.read(blocknum, *ptr);
+    } else {
+        Block block;
+        cache.read(blocknum, block.Data);
+        memcpy(*ptr, block.Data + offset, count);
+    }
+
+    *ptr += count;
+    *length -= count;
+}
+
+ssize_t FileSystem::read(size_t inumber, char* data, size_t length, size_t offset) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    if (!mounted)
+        return -1;
+
+    // dados adiados precisam de blocos antes de serem lidos
+    if (!flush_pending(inumber))
+        return -1;
+
+    std::shared_lock<std::shared_mutex> lock(inode_lock(inumber));
+
+    // carrega o inode uma unica vez (tamanho e ponteiros)
+    Inode node;
+    if (!load_inode(inumber, &node))
+        return -1;
+
+    if (offset >= node.Size || length == 0)
+        return 0;
+    else if (length + offset > node.Size)
+        length = node.Size - offset;
+
+    // arquivo inline: a leitura do bloco de inode ja trouxe os dados
+    if (node.mode & MODE_INLINE) {
+        memcpy(data, node.Inline + offset, length);
+        return length;
+    }
+
+    // blocos do arquivo cobertos pelo intervalo
+    const uint32_t first = offset / block_size;
+    const uint32_t last = (offset + length - 1) / block_size;
+
+    std::vector<uint32_t> blocks;
+    map_blocks(&node, first, last - first + 1, false, blocks, 0, true);
+
+    return read_blocks(blocks.data(), blocks.size(), offset % block_size, data, length);
+}
+
+ssize_t FileSystem::read(FileHandle* handle, char* data, size_t length, size_t offset) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    if (!mounted)
+        return -1;
+
+    // dados adiados precisam de blocos antes de serem lidos
+    if (!flush_pending(handle->Inumber))
+        return -1;
+
+    std::shared_lock<std::shared_mutex> lock(inode_lock(handle->Inumber));
+
+    // inode preso desde o open: sem copia nem leitura do bloco de inode
+    Inode* node;
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        node = &inode_table.at(handle->Inumber).node;
+    }
+    if (node->bonds == 0)
+        return -1;
+
+    if (offset >= node->Size || length == 0)
+        return 0;
+    else if (length + offset > node->Size)
+        length = node->Size - offset;
+
+    if (node->mode & MODE_INLINE) {
+        memcpy(data, node->Inline + offset, length);
+        return length;
+    }
+
+    const uint32_t first = offset / block_size;
+    const uint32_t last = (offset + length - 1) / block_size;
+
+    // mapeamentos nao mudam enquanto o arquivo existe, so blocos novos precisam ser traduzidos
+    std::vector<uint32_t>& blocks = handle->blocks;
+    if (last >= blocks.size())
+        map_blocks(node, blocks.size(), last + 1 - blocks.size(), false, blocks, 0, true);
+
+    if (first >= blocks.size())
+        return 0;
+
+    const size_t count = std::min<size_t>(last + 1, blocks.size()) - first;
+    length = std::min(length, count * block_size - offset % block_size);
+
+    // blocos seguintes ja seguem para o cache enquanto estes sao copiados
+    read_ahead(handle, node, first, last);
+
+    return read_blocks(&blocks[first], count, offset % block_size, data, length);
+}
+
+void FileSystem::read_ahead(FileHandle* handle, Inode* node, size_t first, size_t last) {
+    // continua de onde parou (ou relendo o ultimo bloco parcial): sequencial
+    const bool sequential = handle->next && (first == handle->next || first + 1 == handle->next);
+    handle->next = last + 1;
+
+    if (!sequential) {
+        handle->window = 0;
+        handle->ahead = 0;
+        return;
+    }
+
+    handle->window = handle->window ? std::min<size_t>(handle->window * 2, READAHEAD_MAX) : READAHEAD_MIN;
+
+    const size_t from = std::max(handle->ahead, last + 1);
+    const size_t to = std::min(last + 1 + handle->window, (node->Size + block_size - 1) / block_size);
+    if (from >= to)
+        return;
+
+    std::vector<uint32_t>& blocks = handle->blocks;
+    if (to > blocks.size())
+        map_blocks(node, blocks.size(), to - blocks.size(), false, blocks, 0, true);
+
+    std::vector<int> blocknums;
+    for (size_t i = from; i < std::min(to, blocks.size()); i++) {
+        if (blocks[i])
+            blocknums.push_back(blocks[i]);
+    }
+
+    cache.prefetch(blocknums);
+    handle->ahead = to;
+}
+
+size_t FileSystem::read_blocks(const uint32_t* blocks, size_t count, size_t begin, char* data, size_t length) {
+    // blocos inteiros vao direto para o buffer do usuario numa unica submissao,
+    // inicio e fim parciais passam pelo read_helper enquanto o lote esta em voo
+    struct Partial {
+        uint32_t blocknum;
+        int begin;
+        size_t count;
+        char* ptr;
+    };
+
+    std::vector<Disk::Request> requests;
+    std::vector<Partial> partials;
+    char* ptr = data;
+    size_t remaining = length;
+
+    for (size_t i = 0; i < count; i++) {
+        const size_t bytes = std::min(block_size - begin, remaining);
+        if (!blocks[i])
+            memset(ptr, 0, bytes);
+        else if (bytes == block_size)
+            requests.push_back({(int)blocks[i], ptr});
+        else
+            partials.push_back({blocks[i], (int)begin, bytes, ptr});
+
+        ptr += bytes;
+        remaining -= bytes;
+        begin = 0;
+    }
+
+    uint64_t ticket = cache.read_async(requests);
+
+    for (Partial& partial : partials)
+        read_helper(partial.blocknum, partial.begin, &partial.count, &partial.ptr);
+
+    cache.wait(ticket);
+
+    return length - remaining;
+}
+
+FileHandle* FileSystem::open(size_t inumber) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    return open_inode(inumber);
+}
+
+FileHandle* FileSystem::open_inode(size_t inumber) {
+    if (!mounted || !flush_pending(inumber))
+        return nullptr;
+
+    std::shared_lock<std::shared_mutex> lock(inode_lock(inumber));
+
+    // inode fica preso no cache ate o close (inode livre passa a existir na primeira escrita)
+    Inode* node = acquire_inode(inumber);
+    if (node == nullptr)
+        return nullptr;
+
+    std::unique_ptr<FileHandle> handle(new FileHandle(this, inumber));
+    map_blocks(node, 0, (node->Size + block_size - 1) / block_size, false, handle->blocks);
+
+    std::lock_guard<std::mutex> table(table_lock);
+    handles.push_back(std::move(handle));
+    return handles.back().get();
+}
+
+bool FileSystem::close(FileHandle* handle) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    return close_handle(handle);
+}
+
+bool FileSystem::close_handle(FileHandle* handle) {
+    std::unique_ptr<FileHandle> closing;
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        auto it = std::find_if(handles.begin(), handles.end(), [handle](const std::unique_ptr<FileHandle>& open) { return open.get() == handle; });
+        if (it == handles.end())
+            return false;
+
+        closing = std::move(*it);
+        handles.erase(it);
+    }
+
+    // falha de um flush feito por outro escritor (spill_delayed) aparece no close
+    bool flushed = flush_pending(handle->Inumber);
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        flushed = delayed_errors.erase(handle->Inumber) == 0 && flushed;
+    }
+    release_inode(handle->Inumber, false);
+    return flushed;
+}
+
+bool FileSystem::map_blocks(Inode* node, uint32_t first, uint32_t count, bool alloc, std::vector<uint32_t>& blocks, uint32_t goal,
+                            bool holes) {
+    // dados inline nao tem blocos (promote_inline antes de alocar)
+    if (node->mode & MODE_INLINE)
+        return false;
+
+    if (node->mode & MODE_EXTENTS)
+        return map_extents(node, first, count, alloc, blocks, goal, holes);
+
+    // cursor: blocos de indirecao do caminho atual, relidos apenas quando o caminho muda
+    struct Level {
+        uint32_t blocknum = 0;       // bloco carregado (0 nenhum)
+        bool dirty = false;          // copia alterada, gravar ao trocar de bloco
+        const Block* view = nullptr; // copia em tables ou mapeamento
+    };
+
+    Level levels[3];
+    Block tables[3];
+    const uint64_t P = pointers_per_block;
+
+    // blocos de dados saem de uma sequencia contigua reservada para o restante do intervalo
+    // dentro da tabela atual (a proxima tabela de indirecao e alocada antes da sequencia seguinte:
+    // com o disco quase cheio a reserva nao toma o bloco dela); goal passa a ser o bloco seguinte
+    // ao ultimo mapeado
+    uint32_t run = 0;  // proximo bloco da sequencia
+    uint32_t left = 0; // blocos ainda reservados
+
+    auto allocate_data = [&](uint32_t index, uint64_t span) -> uint32_t {
+        if (left == 0) {
+            const uint64_t rest = first + count - index;
+            run = allocate_run(goal, rest < span ? rest : span, &left);
+            if (left == 0)
+                return 0;
+        }
+        left--;
+        return run++;
+    };
+
+    auto load = [&](int level, uint32_t blocknum, bool fresh) {
+        Level& current = levels[level];
+        if (current.blocknum == blocknum)
+            return;
+
+        if (current.dirty)
+            cache.write(current.blocknum, tables[level].Data);
+
+        current = {blocknum, fresh, &tables[level]};
+        if (fresh)
+            memset(tables[level].Data, 0, block_size);
+        else if (alloc)
+            cache.read(blocknum, tables[level].Data);
+        else
+            current.view = peek(fs_disk, blocknum, &tables[level]);
+    };
+
+    for (uint32_t index = first; index < first + count; index++) {
+        // ponteiro no inode e indice em cada nivel de indirecao
+        uint32_t* root;
+        uint64_t path[3];
+        int depth;
+        uint64_t k = index;
+
+        if (k < POINTERS_PER_INODE) {
+            root = &node->Direct[k];
+            depth = 0;
+        } else if ((k -= POINTERS_PER_INODE) < P) {
+            root = &node->Indirect;
+            path[0] = k;
+            depth = 1;
+        } else if ((k -= P) < P * P) {
+            root = &node->Indirect2;
+            path[0] = k / P;
+            path[1] = k % P;
+            depth = 2;
+        } else if ((k -= P * P) < P * P * P) {
+            root = &node->Indirect3;
+            path[0] = k / (P * P);
+            path[1] = (k / P) % P;
+            path[2] = k % P;
+            depth = 3;
+        } else {
+            break;
+        }
+
+        bool fresh = false;
+        if (!*root && alloc) {
+            *root = depth ? allocate_block(goal) : allocate_data(index, POINTERS_PER_INODE - index);
+            fresh = true;
+        }
+
+        uint32_t blocknum = *root;
+        for (int level = 0; level < depth && blocknum; level++) {
+            load(level, blocknum, fresh);
+
+            blocknum = levels[level].view->Pointers[path[level]];
+            fresh = false;
+
+            if (!blocknum && alloc) {
+                blocknum = (level + 1 < depth) ? allocate_block(goal) : allocate_data(index, P - path[level]);
+                tables[level].Pointers[path[level]] = blocknum;
+                levels[level].dirty = levels[level].dirty || blocknum;
+                fresh = true;
+            }
+        }
+
+        // primeiro bloco nao alocado (ou disco cheio) encerra o mapeamento, exceto buracos pedidos
+        if (!blocknum && !(holes && !alloc))
+            break;
+
+        blocks.push_back(blocknum);
+        if (blocknum)
+            goal = blocknum + 1;
+    }
+
+    // devolve o que sobrou da reserva
+    for (; left > 0; left--)
+        free_blocks.clear(run++);
+
+    for (int level = 0; level < 3; level++) {
+        if (levels[level].dirty)
+            cache.write(levels[level].blocknum, tables[level].Data);
+    }
+
+    return blocks.size() == count;
+}
+
+bool FileSystem::map_extents(Inode* node, uint32_t first, uint32_t count, bool alloc, std::vector<uint32_t>& blocks, uint32_t goal,
+                             bool holes) {
+    uint32_t index = first;
+    const uint32_t end = first + count;
+
+    while (index < end) {
+        Extent extent;
+        uint32_t next;
+
+        // trecho mapeado: todo o extent entra de uma vez
+        if (find_extent(node, index, &extent, &next)) {
+            const uint32_t stop = std::min(end, extent.Logical + extent.Length);
+            for (; index < stop; index++)
+                blocks.push_back(extent.Start + (index - extent.Logical));
+            continue;
+        }
+
+        // buraco ate o proximo extent
+        if (!alloc && holes) {
+            const uint32_t stop = std::min(end, next);
+            blocks.insert(blocks.end(), stop - index, 0);
+            index = stop;
+            continue;
+        }
+
+        if (!alloc)
+            break;
+
+        // aloca o trecho ate o proximo extent, continuando o anterior no disco se possivel
+        const uint32_t from = extent.Length ? extent.Start + (index - extent.Logical) : goal;
+        uint32_t got;
+        const uint32_t start = allocate_run(from, std::min(end, next) - index, &got);
+        if (!got)
+            break;
+
+        if (!insert_extent(node, {index, start, got})) {
+            for (uint32_t k = 0; k < got; k++)
+                free_blocks.clear(start + k);
+            break;
+        }
+
+        for (uint32_t k = 0; k < got; k++, index++)
+            blocks.push_back(start + k);
+    }
+
+    return blocks.size() == count;
+}
+
+bool FileSystem::find_extent(const Inode* node, uint32_t logical, Extent* extent, uint32_t* next) {
+    auto before = [](uint32_t logical, const Extent& extent) { return logical < extent.Logical; };
+    Block scratch;
+    const Extent* entries = node->Extents;
+    uint32_t count = node->Count;
+    *next = UINT32_MAX;
+
+    if (node->Depth > 0) {
+        // raiz e indice: folha com o maior Logical <= logical
+        const Extent* index = std::upper_bound(node->Extents, node->Extents + node->Count, logical, before);
+        if (index != node->Extents)
+            index--;
+
+        if (index + 1 < node->Extents + node->Count)
+            *next = (index + 1)->Logical;
+
+        const Block* leaf = peek(fs_disk, index->Start, &scratch);
+        entries = leaf->Leaf.Extents;
+        count = leaf->Leaf.Count;
+    }
+
+    const Extent* found = std::upper_bound(entries, entries + count, logical, before);
+    if (found != entries + count)
+        *next = found->Logical;
+
+    if (found == entries) {
+        *extent = {logical, 0, 0};
+        return false;
+    }
+
+    *extent = *(found - 1);
+    return logical < extent->Logical + extent->Length;
+}
+
+bool FileSystem::insert_extent(Inode* node, const Extent& extent) {
+    auto before = [](uint32_t logical, const Extent& extent) { return logical < extent.Logical; };
+
+    // estende o extent anterior quando contiguo no arquivo e no disco
+    auto merge = [&](Extent* entries, uint32_t& count) {
+        Extent* pos = std::upper_bound(entries, entries + count, extent.Logical, before);
+        if (pos != entries) {
+            Extent& prev = *(pos - 1);
+            if (prev.Logical + prev.Length == extent.Logical && prev.Start + prev.Length == extent.Start) {
+                prev.Length += extent.Length;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto insert = [&](Extent* entries, uint32_t& count) {
+        Extent* pos = std::upper_bound(entries, entries + count, extent.Logical, before);
+        std::copy_backward(pos, entries + count, entries + count + 1);
+        *pos = extent;
+        count++;
+    };
+
+    if (node->Depth == 0) {
+        uint32_t count = node->Count;
+        if (merge(node->Extents, count))
+            return true;
+
+        if (count < EXTENTS_PER_INODE) {
+            insert(node->Extents, count);
+            node->Count = count;
+            return true;
+        }
+
+        // raiz cheia: extents descem para uma folha e a raiz vira indice
+        uint32_t leafnum = allocate_block(extent.Start);
+        if (!leafnum)
+            return false;
+
+        Block leaf;
+        memset(leaf.Data, 0, block_size);
+        std::copy(node->Extents, node->Extents + count, leaf.Leaf.Extents);
+        leaf.Leaf.Count = count;
+        cache.write(leafnum, leaf.Data);
+
+        node->Extents[0] = {std::min(node->Extents[0].Logical, extent.Logical), leafnum, 0};
+        node->Count = 1;
+        node->Depth = 1;
+    }
+
+    // folha responsavel pelo bloco logico
+    Extent* index = std::upper_bound(node->Extents, node->Extents + node->Count, extent.Logical, before);
+    if (index != node->Extents)
+        index--;
+    else
+        index->Logical = std::min(index->Logical, extent.Logical);
+
+    Block leaf;
+    cache.read(index->Start, leaf.Data);
+
+    if (merge(leaf.Leaf.Extents, leaf.Leaf.Count)) {
+        cache.write(index->Start, leaf.Data);
+        return true;
+    }
+
+    if (leaf.Leaf.Count == extents_per_block) {
+        if (node->Count == EXTENTS_PER_INODE)
+            return false;
+
+        uint32_t siblingnum = allocate_block(index->Start);
+        if (!siblingnum)
+            return false;
+
+        // divide a folha cheia ao meio
+        const uint32_t half = leaf.Leaf.Count / 2;
+        Block sibling;
+        memset(sibling.Data, 0, block_size);
+        std::copy(leaf.Leaf.Extents + half, leaf.Leaf.Extents + leaf.Leaf.Count, sibling.Leaf.Extents);
+        sibling.Leaf.Count = leaf.Leaf.Count - half;
+        leaf.Leaf.Count = half;
+
+        std::copy_backward(index + 1, node->Extents + node->Count, node->Extents + node->Count + 1);
+        *(index + 1) = {sibling.Leaf.Extents[0].Logical, siblingnum, 0};
+        node->Count++;
+
+        if (extent.Logical >= sibling.Leaf.Extents[0].Logical) {
+            insert(sibling.Leaf.Extents, sibling.Leaf.Count);
+        } else {
+            insert(leaf.Leaf.Extents, leaf.Leaf.Count);
+        }
+
+        cache.write(siblingnum, sibling.Data);
+        cache.write(index->Start, leaf.Data);
+        return true;
+    }
+
+    insert(leaf.Leaf.Extents, leaf.Leaf.Count);
+    cache.write(index->Start, leaf.Data);
+    return true;
+}
+
+void FileSystem::list_indirect(Disk* disk, uint32_t blocknum, int depth, std::vector<uint32_t>& tables, std::vector<uint32_t>& blocks) {
+    if (!blocknum)
+        return;
+
+    tables.push_back(blocknum);
+
+    // ponteiro invalido: quem chamou rejeita pelo numero do bloco
+    if (blocknum >= disk->size())
+        return;
+
+    Block scratch;
+    const Block* table = peek(disk, blocknum, &scratch);
+
+    // copia os ponteiros: scratch e reusado pela recursao
+    std::vector<uint32_t> pointers(table->Pointers, table->Pointers + pointers_per_block);
+    for (uint32_t pointer : pointers) {
+        if (!pointer)
+            continue;
+
+        if (depth == 1)
+            blocks.push_back(pointer);
+        else
+            list_indirect(disk, pointer, depth - 1, tables, blocks);
+    }
+}
+
+void FileSystem::list_extents(Disk* disk, const Inode* node, std::vector<Extent>& extents, std::vector<uint32_t>& leaves) {
+    if (node->Depth == 0) {
+        extents.insert(extents.end(), node->Extents, node->Extents + node->Count);
+        return;
+    }
+
+    for (uint32_t i = 0; i < node->Count; i++) {
+        Block scratch;
+        const Block* leaf = peek(disk, node->Extents[i].Start, &scratch);
+        leaves.push_back(node->Extents[i].Start);
+        extents.insert(extents.end(), leaf->Leaf.Extents, leaf->Leaf.Extents + std::min(leaf->Leaf.Count, extents_per_block));
+    }
+}
+
+uint32_t FileSystem::allocate_run(uint32_t goal, uint32_t count, uint32_t* got) {
+    *got = 0;
+    if (!mounted || count == 0)
+        return 0;
+
+    // goal ocupado: primeira sequencia livre com count blocos, senao a maior encontrada
+    size_t length;
+    const uint32_t start = free_blocks.allocate_run(goal, startBlockData, startBlockJournal, count, &length);
+    allocated.fetch_add(length, std::memory_order_relaxed);
+
+    *got = length;
+    return start;
+}
+
+uint32_t FileSystem::allocate_block(uint32_t goal) {
+    if (!mounted)
+        return 0;
+
+    // Procura bloco livre a partir do goal, no grupo dele primeiro
+    size_t blocknum = free_blocks.allocate(goal, startBlockData, startBlockJournal);
+    if (blocknum == startBlockJournal)
+        return 0;
+
+    allocated.fetch_add(1, std::memory_order_relaxed);
+    return blocknum;
+}
+
+ssize_t FileSystem::write_ret(size_t inumber, int ret) {
+    if (!mounted)
+        return -1;
+
+    // inode fica sujo no cache, gravado junto com os vizinhos de bloco
+    release_inode(inumber, true);
+
+    // TODO: melhorar
+    return (ssize_t)ret;
+}
+
+// Write to inode --------------------------------------------------------------
+
+ssize_t FileSystem::write(size_t inumber, char* data, size_t length, size_t offset) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    if (!mounted)
+        return -1;
+
+    // transacao cheia: o commit precisa do namespace exclusivo (nenhuma operacao pela metade)
+    if (journaled && cache.retained() >= journal_batch) {
+        guard.unlock();
+        {
+            std::unique_lock<std::shared_mutex> exclusive(namespace_lock);
+            commit_due();
+        }
+        guard.lock();
+        if (!mounted)
+            return -1;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(inode_lock(inumber));
+    Inode node;
+    const bool loaded = load_inode(inumber, &node);
+
+    // inode ainda nao criado e escritas grandes seguem direto para os blocos
+    if (!loaded || length >= DELAYED_BYTES) {
+        if (!flush_delayed(inumber))
+            return -1;
+        return write_blocks(inumber, data, length, offset);
+    }
+
+    if (length + offset > max_size(&node))
+        return -1;
+
+    if (length == 0)
+        return 0;
+
+    // so escritas sequenciais acumulam, fora de ordem ou buffer cheio grava o adiado antes
+    std::unique_lock<std::mutex> table(table_lock);
+    auto it = delayed.find(inumber);
+    if (it != delayed.end()) {
+        const DelayedWrite& buffered = it->second;
+        if (offset != buffered.offset + buffered.data.size() || buffered.data.size() + length > DELAYED_BYTES) {
+            table.unlock();
+            if (!flush_delayed(inumber))
+                return -1;
+            table.lock();
+        }
+    }
+
+    if (delayed_total + length > DELAYED_TOTAL) {
+        table.unlock();
+        spill_delayed(inumber);
+        table.lock();
+    }
 
-bool FileSystem::add_dir_entry(const uint32_t& nodeId, char name[], Block* dirBlock) {
+    // sem blocos livres para todo o adiado a escrita e sincrona: disco cheio aparece aqui, nao no flush
+    if (!delayed_fits(length)) {
+        table.unlock();
+        if (!flush_delayed(inumber))
+            return -1;
+        return write_blocks(inumber, data, length, offset);
+    }
 
-    uint32_t last = 0;
-    for (; last < FileSystem::DIR_PER_BLOCK; last++) {
-        if ((last < 2) && (strlen(dirBlock->Directories[last].Name) == 0))
-            break;
+    DelayedWrite& buffered = delayed[inumber];
+    if (buffered.data.empty())
+        buffered.offset = offset;
 
-        if (streq(dirBlock->Directories[last].Name, name)) {
-            printf("File already exists\n");
+    buffered.data.insert(buffered.data.end(), data, data + length);
+    delayed_total += length;
+    return length;
+}
+
+ssize_t FileSystem::seek(size_t inumber, size_t offset, int whence) {
+    std::shared_lock<std::shared_mutex> guard(namespace_lock);
+    if (!mounted || (whence != SEEK_DATA && whence != SEEK_HOLE))
+        return -1;
+
+    // dados adiados ainda nao tem blocos
+    if (!flush_pending(inumber))
+        return -1;
+
+    std::shared_lock<std::shared_mutex> lock(inode_lock(inumber));
+    Inode node;
+    if (!load_inode(inumber, &node) || offset >= node.Size)
+        return -1;
+
+    if (node.mode & MODE_INLINE)
+        return (whence == SEEK_DATA) ? (ssize_t)offset : (ssize_t)node.Size;
+
+    // mapa traduzido em lotes; o fim do arquivo conta como buraco
+    const uint32_t end = (node.Size + block_size - 1) / block_size;
+    for (uint32_t index = offset / block_size; index < end;) {
+        const uint32_t count = (end - index < SEEK_BATCH) ? end - index : SEEK_BATCH;
+        std::vector<uint32_t> blocks;
+        map_blocks(&node, index, count, false, blocks, 0, true);
+        blocks.resize(count, 0);
+
+        for (uint32_t k = 0; k < count; k++) {
+            if ((blocks[k] != 0) == (whence == SEEK_DATA))
+                return std::max(offset, (size_t)(index + k) * block_size);
+        }
+        index += count;
+    }
+
+    return (whence == SEEK_DATA) ? -1 : (ssize_t)node.Size;
+}
+
+bool FileSystem::flush_delayed(size_t inumber) {
+    DelayedWrite buffered;
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        auto it = delayed.find(inumber);
+        if (it == delayed.end())
+            return true;
+
+        buffered = std::move(it->second);
+        delayed_total -= buffered.data.size();
+        delayed.erase(it);
+    }
+
+    // todo o trecho alocado de uma vez (uma sequencia contigua) e gravado num unico lote
+    const ssize_t done = write_blocks(inumber, buffered.data.data(), buffered.data.size(), buffered.offset);
+    return done == (ssize_t)buffered.data.size();
+}
+
+bool FileSystem::flush_delayed() {
+    bool ok = true;
+    while (!delayed.empty())
+        ok = flush_delayed(delayed.begin()->first) && ok;
+    return ok;
+}
+
+bool FileSystem::delayed_fits(size_t length) {
+    // blocos alocados desde a ultima contagem saem da folga sem recontar o mapa
+    const size_t used = (allocated.load(std::memory_order_relaxed) - allocated_mark) * block_size;
+    if (delayed_total + length + used <= delayed_room)
+        return true;
+
+    allocated_mark = allocated.load(std::memory_order_relaxed);
+    size_t available = 0;
+    for (uint32_t g = 0; g < groups.size(); g++)
+        available += free_blocks.available(g);
+
+    // tabelas de indirecao e blocos parciais nas pontas de cada buffer
+    const size_t slack = available / pointers_per_block + 3 * (delayed.size() + 1);
+    delayed_room = (available > slack) ? (available - slack) * block_size : 0;
+    return delayed_total + length <= delayed_room;
+}
+
+void FileSystem::drop_delayed(size_t inumber) {
+    std::lock_guard<std::mutex> table(table_lock);
+    delayed_errors.erase(inumber);
+    auto it = delayed.find(inumber);
+    if (it == delayed.end())
+        return;
+
+    delayed_total -= it->second.data.size();
+    delayed.erase(it);
+}
+
+bool FileSystem::flush_pending(size_t inumber) {
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        if (delayed.find(inumber) == delayed.end())
+            return true;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(inode_lock(inumber));
+    return flush_delayed(inumber);
+}
+
+void FileSystem::spill_delayed(size_t inumber) {
+    std::vector<uint32_t> pending;
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        for (auto& [other, buffered] : delayed)
+            pending.push_back(other);
+    }
+
+    // inode com lock ocupado fica para o seu escritor; faixa do proprio inode ja e desta thread.
+    // Falha fica registrada para o close/sync do inode
+    auto flush = [&](uint32_t other) {
+        if (!flush_delayed(other)) {
+            std::lock_guard<std::mutex> table(table_lock);
+            delayed_errors.insert(other);
+        }
+    };
+
+    for (uint32_t other : pending) {
+        if (&inode_lock(other) == &inode_lock(inumber)) {
+            flush(other);
+            continue;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(inode_lock(other), std::try_to_lock);
+        if (lock.owns_lock())
+            flush(other);
+    }
+}
+
+uint64_t FileSystem::max_size(const Inode* node) {
+    const bool extents = (node->bonds > 0) ? (node->mode & MODE_EXTENTS) : (MetaData.Features & FEATURE_EXTENTS);
+    if (extents)
+        return UINT32_MAX;
+
+    const uint64_t P = pointers_per_block;
+    const uint64_t pointers = POINTERS_PER_INODE + P + P * P + P * P * P;
+    return std::min<uint64_t>(pointers * block_size, UINT32_MAX);
+}
+
+bool FileSystem::inline_fits(const Inode* node, size_t end) {
+    if (!(MetaData.Features & FEATURE_INLINE) || end > INLINE_BYTES || (node->mode >> 12) != 1)
+        return false;
+
+    if (node->mode & MODE_INLINE)
+        return true;
+
+    // so arquivo sem nenhum bloco: area de ponteiros/extents toda zerada
+    for (uint32_t i = 0; i < INLINE_BYTES; i++) {
+        if (node->Inline[i])
             return false;
+    }
+    return node->Size == 0;
+}
+
+bool FileSystem::promote_inline(size_t inumber, Inode* node) {
+    // bloco em buffer alinhado (O_DIRECT), resto do bloco zerado
+    size_t space = block_size + Disk::DIRECT_ALIGNMENT;
+    std::vector<char> buffer(space);
+    void* ptr = buffer.data();
+    char* block = (char*)std::align(Disk::DIRECT_ALIGNMENT, block_size, ptr, space);
+    memset(block, 0, block_size);
+    memcpy(block, node->Inline, node->Size);
+
+    const Inode saved = *node;
+    memset(node->Inline, 0, INLINE_BYTES);
+    node->mode &= ~MODE_INLINE;
+
+    std::vector<uint32_t> blocks;
+    if (!map_blocks(node, 0, 1, true, blocks, groups[inode_group(inumber)].FirstBlock)) {
+        *node = saved;
+        return false;
+    }
+
+    cache.writev({{(int)blocks[0], block}});
+    return true;
+}
+
+ssize_t FileSystem::write_blocks(size_t inumber, char* data, size_t length, size_t offset) {
+    // inode fica preso no cache ate o fim da escrita
+    Inode* cached = acquire_inode(inumber);
+    if (cached == nullptr)
+        return -1;
+
+    Inode& node = *cached;
+    const bool loaded = node.bonds > 0;
+    const bool extents = loaded ? (node.mode & MODE_EXTENTS) : (MetaData.Features & FEATURE_EXTENTS);
+
+    // verifica se arquivo é maior do que a capacidade total maxima de armazenamento
+    if (length + offset > max_size(&node)) {
+        release_inode(inumber, false);
+        return -1;
+    }
+
+    if (length == 0) {
+        release_inode(inumber, false);
+        return 0;
+    }
+
+    if (!loaded) {
+        // entradas consecutivas com offset != 0 inode sera atualizado
+        memset(&node, 0, sizeof(Inode));
+        node.bonds = 1;
+        node.mode = 0b0001000110110110;
+        if (extents)
+            node.mode |= MODE_EXTENTS;
+
+        std::lock_guard<std::mutex> table(table_lock);
+
+        // bloco de inodes ainda nao zerado (FEATURE_LAZY_INIT): zera antes, como no create_inode,
+        // senao um create posterior no mesmo bloco apaga este inode
+        const uint32_t indexBlockInode = inumber / inodes_per_block;
+        if (indexBlockInode >= MetaData.InodesInit) {
+            Block block;
+            init_inodes(indexBlockInode + 1, &block);
         }
 
-        if ((last >= 2) && (dirBlock->Directories[last].inum == 0)) // vazio a partir daqui
-            break;
+        inode_counter[indexBlockInode]++;
+        free_inodes.set(inumber);
+        groups[inode_group(inumber)].FreeInodes--;
+    }
+
+    // arquivo pequeno fica no inode; passando do limite o conteudo vai para o primeiro bloco
+    if (inline_fits(&node, offset + length)) {
+        node.mode |= MODE_INLINE;
+        memcpy(node.Inline + offset, data, length);
+        node.Size = std::max((size_t)node.Size, offset + length);
+        return write_ret(inumber, length);
+    }
+
+    if ((node.mode & MODE_INLINE) && !promote_inline(inumber, &node))
+        return write_ret(inumber, 0);
+
+    const uint32_t first = offset / block_size;
+    const uint32_t last = (offset + length - 1) / block_size;
+    const size_t head = offset % block_size;            // bytes preservados no inicio do primeiro bloco
+    const size_t tail = (offset + length) % block_size; // bytes gravados no ultimo bloco (0 = inteiro)
+
+    // bloco parcial ja existente precisa do conteudo atual (read-merge-write), novo comeca zerado
+    auto exists = [&](uint32_t index) {
+        std::vector<uint32_t> found;
+        return loaded && map_blocks(&node, index, 1, false, found);
+    };
+    const bool merge_head = (head || (first == last && tail)) && exists(first);
+    const bool merge_tail = (first != last && tail) && exists(last);
+
+    // aloca todos os blocos do intervalo antes de gravar, a partir do grupo do inode
+    const uint32_t count = last - first + 1;
+    std::vector<uint32_t> blocks;
+    uint32_t goal = groups[inode_group(inumber)].FirstBlock;
+
+    if (MetaData.Features & FEATURE_SPARSE) {
+        // bloco ainda nao alocado que so receberia zeros continua buraco
+        std::vector<uint32_t> current;
+        if (loaded)
+            map_blocks(&node, first, count, false, current, 0, true);
+        current.resize(count, 0);
+
+        auto hole = [&](uint32_t i) {
+            const size_t skip = i ? block_size - head + (size_t)(i - 1) * block_size : 0;
+            const size_t bytes = std::min(block_size - (i ? 0 : head), length - skip);
+            if (current[i])
+                return false;
+            for (size_t k = 0; k < bytes; k++) {
+                if (data[skip + k])
+                    return false;
+            }
+            return true;
+        };
+
+        for (uint32_t i = 0; i < count && blocks.size() == i;) {
+            if (hole(i)) {
+                blocks.push_back(0);
+                i++;
+                continue;
+            }
+
+            uint32_t j = i + 1;
+            while (j < count && !hole(j))
+                j++;
+
+            map_blocks(&node, first + i, j - i, true, blocks, goal);
+            if (!blocks.empty() && blocks.back())
+                goal = blocks.back() + 1;
+            i = j;
+        }
+    } else {
+        map_blocks(&node, first, count, true, blocks, goal);
+    }
+
+    // handles abertos podem ter mapeado como buraco (0) um bloco alocado agora
+    {
+        std::lock_guard<std::mutex> table(table_lock);
+        for (std::unique_ptr<FileHandle>& handle : handles) {
+            std::vector<uint32_t>& mapped = handle->blocks;
+            if (handle->Inumber != inumber)
+                continue;
+            for (size_t k = first; k < mapped.size() && k <= last; k++) {
+                if (!mapped[k]) {
+                    mapped.resize(k);
+                    break;
+                }
+            }
+        }
+    }
+
+    // blocos inteiros saem direto do buffer de entrada, so cabeca e cauda passam por edges
+    // (alinhado para O_DIRECT, um por chamada: escritas de inodes diferentes sao concorrentes)
+    size_t space = 2 * block_size + Disk::DIRECT_ALIGNMENT;
+    std::vector<char> edge_buffer((head || tail) ? space : 0);
+    void* ptr = edge_buffer.data();
+    char* edges = (head || tail) ? (char*)std::align(Disk::DIRECT_ALIGNMENT, 2 * block_size, ptr, space) : nullptr;
+
+    std::vector<Disk::Request> requests;
+    size_t done = 0;
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const size_t begin = (i == 0) ? head : 0;
+        const size_t bytes = std::min(block_size - begin, length - done);
+        char* block = data + done;
+
+        // buraco mantido: nada a gravar
+        if (!blocks[i]) {
+            done += bytes;
+            continue;
+        }
+
+        if (bytes != block_size) {
+            const bool tail_block = (first + i == last) && (i != 0);
+            block = edges + (tail_block ? block_size : 0);
+
+            if (tail_block ? merge_tail : merge_head)
+                cache.read(blocks[i], block);
+            else
+                memset(block, 0, block_size);
+
+            memcpy(block + begin, data + done, bytes);
+        }
+
+        requests.push_back({(int)blocks[i], block});
+        done += bytes;
+    }
+
+    cache.writev(requests);
+
+    // falhou em alocar todo o espaço grava apenas o que conseguiu
+    node.Size = std::max((size_t)node.Size, offset + done);
+    return write_ret(inumber, done);
+}
+
+// FIXME: abaixo sera em outra classe
+
+// Necessario para criar arquivo
+
+bool FileSystem::add_dir_entry(const uint32_t& nodeId, char name[], Block* dirBlock) {
+    DirBucket& bucket = dirBlock->Bucket;
+
+    for (uint32_t i = 0; i < bucket.Count; i++) {
+        if (strncmp(bucket.Entries[i].Name, name, NAMESIZE - 1) == 0) {
+            printf("File already exists\n");
+            return false;
+        }
     }
 
     DirEntry entry;
     memset(&entry, 0, sizeof(DirEntry));
-    strcpy(entry.Name, name);
+    strncpy(entry.Name, name, NAMESIZE - 1);
     entry.inum = nodeId;
-    memcpy(&(dirBlock->Directories[last]), &entry, sizeof(DirEntry));
+    memcpy(&(bucket.Entries[bucket.Count++]), &entry, sizeof(DirEntry));
+
+    return true;
+}
+
+uint32_t FileSystem::dir_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < NAMESIZE - 1 && name[i]; i++)
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    return hash;
+}
+
+bool FileSystem::dir_block(FileHandle* dir, uint32_t logical, Block* block) {
+    std::vector<uint32_t>& blocks = dir->blocks;
+    if (logical >= blocks.size())
+        map_blocks(&inode_table.at(dir->Inumber).node, blocks.size(), logical + 1 - blocks.size(), false, blocks);
+
+    if (logical >= blocks.size())
+        return false;
+
+    cache.read(blocks[logical], block->Data);
+    return true;
+}
+
+bool FileSystem::dir_store(FileHandle* dir, uint32_t logical, Block* block) {
+    std::vector<uint32_t>& blocks = dir->blocks;
+    if (logical >= blocks.size())
+        map_blocks(&inode_table.at(dir->Inumber).node, blocks.size(), logical + 1 - blocks.size(), false, blocks);
+
+    // bloco existente: write-back como os demais metadados
+    if (logical < blocks.size()) {
+        cache.write(blocks[logical], block->Data);
+        return true;
+    }
+
+    // proximo bloco do arquivo: aloca e grava
+    return write_blocks(dir->Inumber, block->Data, block_size, (size_t)logical * block_size) == (ssize_t)block_size;
+}
+
+void FileSystem::dir_slot(const DirHeader& header, uint32_t slot, uint32_t* logical, uint32_t* word) {
+    if (header.Index == 0) {
+        *logical = 0;
+        *word = DIR_HEADER_WORDS + slot;
+    } else {
+        *logical = header.Index + slot / pointers_per_block;
+        *word = slot % pointers_per_block;
+    }
+}
+
+uint32_t FileSystem::dir_bucket(FileHandle* dir, const Block* head, uint32_t hash) {
+    const uint32_t slot = hash & ((1u << head->Dir.Depth) - 1);
+
+    uint32_t logical, word;
+    dir_slot(head->Dir, slot, &logical, &word);
+    if (logical == 0)
+        return head->Pointers[word];
+
+    Block index;
+    if (!dir_block(dir, logical, &index))
+        return 0;
+    return index.Pointers[word];
+}
+
+bool FileSystem::dir_grow(FileHandle* dir, Block* head) {
+    DirHeader& header = head->Dir;
+    if (header.Depth >= DIR_MAX_DEPTH)
+        return false;
+
+    const uint32_t slots = 1u << header.Depth;
+
+    // ainda cabe no bloco do cabecalho: copia a metade de baixo para a de cima
+    if (header.Index == 0 && DIR_HEADER_WORDS + 2 * slots <= pointers_per_block) {
+        memcpy(&head->Pointers[DIR_HEADER_WORDS + slots], &head->Pointers[DIR_HEADER_WORDS], slots * sizeof(uint32_t));
+        header.Depth++;
+        return true;
+    }
+
+    // nova regiao no fim do arquivo: entrada i e i + slots apontam o mesmo bucket
+    const uint32_t start = header.Blocks;
+    const uint32_t count = (2 * slots + pointers_per_block - 1) / pointers_per_block;
+
+    Block source, target;
+    uint32_t loaded = UINT32_MAX;
+    for (uint32_t k = 0; k < count; k++) {
+        memset(target.Data, 0, block_size);
+
+        for (uint32_t w = 0; w < pointers_per_block && k * pointers_per_block + w < 2 * slots; w++) {
+            uint32_t logical, word;
+            dir_slot(header, (k * pointers_per_block + w) % slots, &logical, &word);
+
+            const Block* from = head;
+            if (logical != 0) {
+                if (logical != loaded && !dir_block(dir, logical, &source))
+                    return false;
+                loaded = logical;
+                from = &source;
+            }
+            target.Pointers[w] = from->Pointers[word];
+        }
+
+        if (!dir_store(dir, start + k, &target))
+            return false;
+    }
+
+    // blocos do indice antigo viram buckets; se ainda sobram blocos de um indice anterior (hashes
+    // concentrados, raro) o antigo fica sem uso em vez de perder a faixa livre atual
+    if (header.Index != 0 && header.FreeCount == 0) {
+        header.FreeStart = header.Index;
+        header.FreeCount = (slots + pointers_per_block - 1) / pointers_per_block;
+    }
 
+    header.Index = start;
+    header.Blocks += count;
+    header.Depth++;
     return true;
 }
 
+ssize_t FileSystem::dir_lookup(FileHandle* dir, const char* name) {
+    // nomes guardados tem no maximo NAMESIZE - 1 caracteres: um maior nao existe (nem pelo prefixo)
+    Block head, bucket;
+    if (strnlen(name, NAMESIZE) >= NAMESIZE || !dir_block(dir, 0, &head) || head.Dir.Magic != DIR_MAGIC)
+        return -1;
+
+    const uint32_t logical = dir_bucket(dir, &head, dir_hash(name));
+    if (logical == 0 || !dir_block(dir, logical, &bucket))
+        return -1;
+
+    for (uint32_t i = 0; i < bucket.Bucket.Count; i++) {
+        if (strncmp(bucket.Bucket.Entries[i].Name, name, NAMESIZE - 1) == 0)
+            return bucket.Bucket.Entries[i].inum;
+    }
+
+    return -1;
+}
+
+bool FileSystem::dir_insert(FileHandle* dir, const char* name, uint32_t inumber) {
+    Block head, bucket, sibling;
+    if (strnlen(name, NAMESIZE) >= NAMESIZE || !dir_block(dir, 0, &head) || head.Dir.Magic != DIR_MAGIC)
+        return false;
+
+    DirHeader& header = head.Dir;
+    const uint32_t hash = dir_hash(name);
+    const uint32_t capacity = dir_per_block - 1;
+
+    while (true) {
+        const uint32_t logical = dir_bucket(dir, &head, hash);
+        if (logical == 0 || !dir_block(dir, logical, &bucket))
+            return false;
+
+        if (bucket.Bucket.Count < capacity) {
+            if (!add_dir_entry(inumber, (char*)name, &bucket))
+                return false;
+
+            header.Entries++;
+            return dir_store(dir, logical, &bucket) && dir_store(dir, 0, &head);
+        }
+
+        // bucket cheio: duplicata so pode estar nele
+        for (uint32_t i = 0; i < bucket.Bucket.Count; i++) {
+            if (strncmp(bucket.Bucket.Entries[i].Name, name, NAMESIZE - 1) == 0) {
+                printf("File already exists\n");
+                return false;
+            }
+        }
+
+        // bucket tem tantos bits quanto o indice: dobra o indice antes de dividir
+        const uint32_t depth = bucket.Bucket.Depth;
+        if (depth == header.Depth && !dir_grow(dir, &head))
+            return false;
+
+        // novo bucket recebe as entradas com o bit depth ligado
+        const uint32_t split = header.FreeCount ? header.FreeStart : header.Blocks;
+        memset(sibling.Data, 0, block_size);
+        sibling.Bucket.Depth = depth + 1;
+        bucket.Bucket.Depth = depth + 1;
+
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < bucket.Bucket.Count; i++) {
+            const DirEntry& entry = bucket.Bucket.Entries[i];
+            if ((dir_hash(entry.Name) >> depth) & 1)
+                sibling.Bucket.Entries[sibling.Bucket.Count++] = entry;
+            else
+                bucket.Bucket.Entries[kept++] = entry;
+        }
+        memset(&bucket.Bucket.Entries[kept], 0, (bucket.Bucket.Count - kept) * sizeof(DirEntry));
+        bucket.Bucket.Count = kept;
+
+        if (!dir_store(dir, split, &sibling))
+            return false;
+
+        if (header.FreeCount) {
+            header.FreeStart++;
+            header.FreeCount--;
+        } else {
+            header.Blocks++;
+        }
+
+        // entradas do indice com os bits baixos do bucket e o bit depth ligado passam ao novo
+        const uint32_t slots = 1u << header.Depth;
+        Block index;
+        uint32_t loaded = 0;
+        for (uint32_t slot = (hash & ((1u << depth) - 1)) | (1u << depth); slot < slots; slot += 2u << depth) {
+            uint32_t position, word;
+            dir_slot(header, slot, &position, &word);
+
+            if (position == 0) {
+                head.Pointers[word] = split;
+                continue;
+            }
+
+            if (position != loaded) {
+                if (loaded && !dir_store(dir, loaded, &index))
+                    return false;
+                if (!dir_block(dir, position, &index))
+                    return false;
+                loaded = position;
+            }
+            index.Pointers[word] = split;
+        }
+
+        if ((loaded && !dir_store(dir, loaded, &index)) || !dir_store(dir, logical, &bucket) || !dir_store(dir, 0, &head))
+            return false;
+    }
+}
+
 bool FileSystem::touch(char name[FileSystem::NAMESIZE]) {
-    if (!mounted) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    commit_due();
+    if (!mounted || curr_dir == nullptr) {
         return false;
     }
 
-    Block dirBlock;
-    fs_disk->read(curr_dir, dirBlock.Data);
+    // mesmo limite do split_path: nome maior seria truncado na entrada
+    if (strnlen(name, NAMESIZE) >= NAMESIZE) {
+        printf("Name too long\n");
+        return false;
+    }
 
-    // Aloca um inode para os dados do arquivo
-    ssize_t new_node_idx = this->create();
+    // Aloca um inode para os dados do arquivo, no grupo do diretorio
+    ssize_t new_node_idx = this->create_inode(inode_group(curr_dir->Inumber));
     if (new_node_idx == -1) {
         printf("Error creating new Dir inode\n");
         return false;
     }
 
-    if (this->add_dir_entry(new_node_idx, name, &dirBlock) == false) {
-        this->remove(new_node_idx);
+    if (this->dir_insert(curr_dir, name, new_node_idx) == false) {
+        this->remove_inode(new_node_idx);
         return false;
     }
 
-    fs_disk->write(curr_dir, dirBlock.Data);
-
+    dcache.insert(curr_dir->Inumber, name, new_node_idx);
     return true;
-}
\ No newline at end of file
+}
+
+FileHandle* FileSystem::open_dir(uint32_t inumber) {
+    auto it = directories.find(inumber);
+    if (it != directories.end())
+        return it->second;
+
+    // limite de diretorios abertos: fecha todos menos o corrente
+    if (directories.size() >= DIR_HANDLES) {
+        for (auto& [number, dir] : directories) {
+            if (dir != curr_dir)
+                close_handle(dir);
+        }
+        directories.clear();
+        if (curr_dir != nullptr)
+            directories[curr_dir->Inumber] = curr_dir;
+    }
+
+    FileHandle* dir = open_inode(inumber);
+    if (dir == nullptr)
+        return nullptr;
+
+    // tipo 0000 no mode: diretorio
+    const Inode& node = inode_table.at(inumber).node;
+    if (node.bonds == 0 || (node.mode >> 12) != 0) {
+        close_handle(dir);
+        return nullptr;
+    }
+
+    directories[inumber] = dir;
+    return dir;
+}
+
+ssize_t FileSystem::lookup_name(uint32_t parent, const char* name) {
+    ssize_t inumber;
+    if (dcache.find(parent, name, &inumber))
+        return inumber;
+
+    FileHandle* dir = open_dir(parent);
+    if (dir == nullptr)
+        return -1;
+
+    // nome ausente tambem fica em cache (entrada negativa)
+    inumber = dir_lookup(dir, name);
+    dcache.insert(parent, name, inumber);
+    return inumber;
+}
+
+ssize_t FileSystem::resolve_parent(const char* path, char* name) {
+    if (!mounted || curr_dir == nullptr || path == nullptr)
+        return -1;
+
+    ssize_t parent = (path[0] == '/') ? ROOT_INODE : curr_dir->Inumber;
+    name[0] = 0;
+
+    while (true) {
+        while (*path == '/')
+            path++;
+        if (*path == 0)
+            return parent;
+
+        const char* end = strchrnul(path, '/');
+        if (end - path >= (ptrdiff_t)NAMESIZE)
+            return -1;
+
+        // componente anterior e um diretorio intermediario
+        if (name[0] != 0) {
+            parent = lookup_name(parent, name);
+            if (parent < 0)
+                return -1;
+        }
+
+        memcpy(name, path, end - path);
+        name[end - path] = 0;
+        path = end;
+    }
+}
+
+ssize_t FileSystem::lookup(const char* path) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    return resolve(path);
+}
+
+ssize_t FileSystem::resolve(const char* path) {
+    char name[NAMESIZE];
+    const ssize_t parent = resolve_parent(path, name);
+    if (parent < 0 || name[0] == 0)
+        return parent;
+
+    return lookup_name(parent, name);
+}
+
+FileHandle* FileSystem::open(const char* path) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    const ssize_t inumber = resolve(path);
+    if (inumber < 0)
+        return nullptr;
+
+    return open_inode(inumber);
+}
+
+ssize_t FileSystem::mkdir(const char* path) {
+    std::unique_lock<std::shared_mutex> guard(namespace_lock);
+    commit_due();
+    char name[NAMESIZE];
+    const ssize_t parent = resolve_parent(path, name);
+    if (parent < 0 || name[0] == 0 || lookup_name(parent, name) >= 0)
+        return -1;
+
+    FileHandle* up = open_dir(parent);
+    if (up == nullptr)
+        return -1;
+
+    const ssize_t inumber = create_inode(dir_group(parent));
+    if (inumber < 0)
+        return -1;
+
+    FileHandle* dir = open_inode(inumber);
+    if (dir == nullptr) {
+        remove_inode(inumber);
+        return -1;
+    }
+
+    Inode* node = &inode_table.at(inumber).node;
+    node->mode = 0b0000000100100100 | (node->mode & MODE_EXTENTS); // 0000 000r--r--r-- Diretorio
+    inode_table.at(inumber).dirty = true;
+    groups[inode_group(inumber)].Directories++;
+
+    // mesmo formato do diretorio raiz: cabecalho e um bucket com "." e ".."
+    Block head, bucket;
+    memset(&head, 0, sizeof(Block));
+    head.Dir = {DIR_MAGIC, 0, 0, 2, 0, 0, 2, 0};
+    head.Pointers[DIR_HEADER_WORDS] = 1;
+
+    memset(&bucket, 0, sizeof(Block));
+    add_dir_entry(inumber, (char*)".", &bucket);
+    add_dir_entry(parent, (char*)"..", &bucket);
+
+    const bool stored = dir_store(dir, 0, &head) && dir_store(dir, 1, &bucket);
+    close_handle(dir);
+
+    if (!stored || !dir_insert(up, name, inumber)) {
+        remove_inode(inumber);
+        return -1;
+    }
+
+    dcache.insert(parent, name, inumber);
+    return inumber;
+}
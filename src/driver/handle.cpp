@@ -0,0 +1,23 @@
+#include "sfs/handle.hpp"
+#include "sfs/fs.hpp"
+
+ssize_t FileHandle::read(char* data, size_t length) {
+    ssize_t done = fs->read(this, data, length, position);
+    if (done > 0)
+        position += done;
+    return done;
+}
+
+ssize_t FileHandle::write(char* data, size_t length) {
+    ssize_t done = fs->write(Inumber, data, length, position);
+    if (done > 0)
+        position += done;
+    return done;
+}
+
+ssize_t FileHandle::seek(size_t offset, int whence) {
+    ssize_t found = fs->seek(Inumber, offset, whence);
+    if (found >= 0)
+        position = found;
+    return found;
+}
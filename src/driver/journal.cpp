@@ -0,0 +1,167 @@
+#include "sfs/journal.hpp"
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <string.h>
+
+Journal::~Journal() {
+    if (Commits + Replayed > 0) {
+        std::cout << std::format("{0} journal commits", Commits) << std::endl;
+        std::cout << std::format("{0} journal blocks", Logged) << std::endl;
+        std::cout << std::format("{0} journal replays", Replayed) << std::endl;
+    }
+}
+
+void Journal::attach(Disk* disk, uint32_t start, uint32_t blocks) {
+    this->disk = disk;
+    Start = start;
+    Blocks = blocks;
+    head = 1;
+    sequence = 1;
+}
+
+void Journal::format(Disk* disk, uint32_t start) {
+    std::vector<char> block(disk->block_size(), 0);
+    *(Record*)block.data() = {MAGIC, HEADER, 1, 0, 0};
+    disk->write(start, block.data());
+}
+
+uint32_t Journal::checksum(uint32_t hash, const char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void Journal::write_header() {
+    std::vector<char> block(disk->block_size(), 0);
+    *(Record*)block.data() = {MAGIC, HEADER, sequence, 0, 0};
+    disk->write(Start, block.data());
+    disk->sync();
+}
+
+size_t Journal::replay() {
+    const size_t bytes = disk->block_size();
+    std::vector<char> control(bytes);
+    const Record* record = (const Record*)control.data();
+
+    // sem cabecalho (regiao nunca usada): log vazio
+    disk->read(Start, control.data());
+    sequence = (record->Magic == MAGIC && record->Type == HEADER) ? record->Sequence : 1;
+
+    size_t applied = 0;
+    uint32_t pos = 1;
+
+    while (true) {
+        // descritores e imagens de uma transacao, ate o bloco de commit
+        std::vector<uint32_t> destinations;
+        std::vector<char> images;
+        uint32_t hash = 2166136261u;
+        uint32_t at = pos;
+        bool complete = false;
+
+        while (at < Blocks) {
+            disk->read(Start + at++, control.data());
+            if (record->Magic != MAGIC || record->Sequence != sequence)
+                break;
+
+            if (record->Type == COMMIT) {
+                complete = !destinations.empty() && record->Count == destinations.size() && record->Checksum == hash;
+                break;
+            }
+
+            if (record->Type != DESCRIPTOR || record->Count > targets() || at + record->Count > Blocks)
+                break;
+
+            hash = checksum(hash, control.data(), bytes);
+            const uint32_t* list = (const uint32_t*)(control.data() + sizeof(Record));
+            destinations.insert(destinations.end(), list, list + record->Count);
+
+            // imagens do descritor numa unica leitura
+            const size_t offset = images.size();
+            images.resize(offset + record->Count * bytes);
+            std::vector<Disk::Request> requests;
+            for (uint32_t k = 0; k < record->Count; k++)
+                requests.push_back({(int)(Start + at + k), &images[offset + k * bytes]});
+            disk->readv(requests);
+
+            hash = checksum(hash, &images[offset], record->Count * bytes);
+            at += record->Count;
+        }
+
+        // destino fora do disco ou dentro do log: transacao nao e nossa
+        for (uint32_t blocknum : destinations)
+            complete = complete && blocknum < disk->size() && (blocknum < Start || blocknum >= Start + Blocks);
+
+        if (!complete)
+            break;
+
+        std::vector<Disk::Request> requests;
+        for (size_t i = 0; i < destinations.size(); i++)
+            requests.push_back({(int)destinations[i], &images[i * bytes]});
+        std::sort(requests.begin(), requests.end(), [](const Disk::Request& a, const Disk::Request& b) { return a.blocknum < b.blocknum; });
+        disk->writev(requests);
+
+        applied++;
+        sequence++;
+        pos = at;
+    }
+
+    // blocos reaplicados no disco antes de o log recomecar
+    if (applied)
+        disk->sync();
+
+    Replayed += applied;
+    reset();
+    return applied;
+}
+
+void Journal::commit(const std::vector<Disk::Request>& blocks) {
+    const size_t bytes = disk->block_size();
+    const size_t per = targets();
+    const size_t descriptors = (blocks.size() + per - 1) / per;
+
+    // descritores e commit seguem as imagens numa unica sequencia de blocos
+    std::vector<char> control((descriptors + 1) * bytes, 0);
+    std::vector<Disk::Request> requests;
+    uint32_t hash = 2166136261u;
+    int at = Start + head;
+
+    for (size_t d = 0; d < descriptors; d++) {
+        char* descriptor = &control[d * bytes];
+        const size_t first = d * per;
+        const size_t count = std::min(per, blocks.size() - first);
+
+        *(Record*)descriptor = {MAGIC, DESCRIPTOR, sequence, (uint32_t)count, 0};
+        uint32_t* list = (uint32_t*)(descriptor + sizeof(Record));
+        for (size_t k = 0; k < count; k++)
+            list[k] = blocks[first + k].blocknum;
+
+        hash = checksum(hash, descriptor, bytes);
+        requests.push_back({at++, descriptor});
+
+        for (size_t k = 0; k < count; k++) {
+            hash = checksum(hash, blocks[first + k].data, bytes);
+            requests.push_back({at++, blocks[first + k].data});
+        }
+    }
+
+    char* commit = &control[descriptors * bytes];
+    *(Record*)commit = {MAGIC, COMMIT, sequence, (uint32_t)blocks.size(), hash};
+    requests.push_back({at++, commit});
+
+    // group commit: uma escrita sequencial e um unico sync para todas as operacoes da transacao
+    disk->writev(requests);
+    disk->sync();
+
+    head = at - Start;
+    sequence++;
+    Commits++;
+    Logged += requests.size();
+}
+
+void Journal::reset() {
+    head = 1;
+    write_header();
+}
@@ -2,12 +2,14 @@
 
 #include "sfs/disk.hpp"
 #include "sfs/fs.hpp"
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <unistd.h>
 
 // Macros
 
@@ -16,8 +18,10 @@
 // Command prototypes
 
 void do_debug(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
-void do_format(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
+void do_format(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2, char* arg3, char* arg4, char* arg5, char* arg6);
 void do_mount(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
+void do_unmount(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
+void do_sync(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
 void do_cat(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
 void do_copyout(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
 void do_create(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
@@ -27,6 +31,9 @@ void do_copyin(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
 void do_help(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
 
 void do_touch(FileSystem& fs, char* path);
+void do_mkdir(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
+void do_lookup(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2);
+void do_seek(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2, char* arg3);
 
 bool copyout(FileSystem& fs, size_t inumber, const char* path);
 bool copyin(FileSystem& fs, const char* path, size_t inumber);
@@ -37,20 +44,38 @@ int main(int argc, char* argv[]) {
     Disk disk;
     FileSystem fs;
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <diskfile> <nblocks>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <diskfile> <nblocks> [stream|posix|direct|mmap]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
+    Disk::Mode mode = Disk::Mode::Stream;
+    if (argc == 4) {
+        if (streq(argv[3], "posix")) {
+            mode = Disk::Mode::Posix;
+        } else if (streq(argv[3], "direct")) {
+            mode = Disk::Mode::Direct;
+        } else if (streq(argv[3], "mmap")) {
+            mode = Disk::Mode::Mmap;
+        } else if (!streq(argv[3], "stream")) {
+            fprintf(stderr, "Unknown disk backend: %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+    }
+
     try {
-        disk.open(argv[1], atoi(argv[2]));
+        disk.open(argv[1], atoi(argv[2]), mode);
     } catch (std::runtime_error& e) {
         fprintf(stderr, "Unable to open disk %s: %s\n", argv[1], e.what());
         return EXIT_FAILURE;
     }
 
+    // backend escolhido na linha de comando: mostra o motor de I/O em lote que o disco usa
+    if (argc == 4)
+        printf("async engine: %s\n", disk.engine());
+
     while (true) {
-        char line[BUFSIZ], cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ];
+        char line[BUFSIZ], cmd[BUFSIZ], arg1[BUFSIZ], arg2[BUFSIZ], arg3[BUFSIZ], arg4[BUFSIZ], arg5[BUFSIZ], arg6[BUFSIZ];
 
         fprintf(stderr, "sfs> ");
         fflush(stderr);
@@ -59,7 +84,7 @@ int main(int argc, char* argv[]) {
             break;
         }
 
-        int args = sscanf(line, "%s %s %s", cmd, arg1, arg2);
+        int args = sscanf(line, "%s %s %s %s %s %s %s", cmd, arg1, arg2, arg3, arg4, arg5, arg6);
         if (args == 0) {
             continue;
         }
@@ -67,9 +92,13 @@ int main(int argc, char* argv[]) {
         if (streq(cmd, "debug")) {
             do_debug(disk, fs, args, arg1, arg2);
         } else if (streq(cmd, "format")) {
-            do_format(disk, fs, args, arg1, arg2);
+            do_format(disk, fs, args, arg1, arg2, arg3, arg4, arg5, arg6);
         } else if (streq(cmd, "mount")) {
             do_mount(disk, fs, args, arg1, arg2);
+        } else if (streq(cmd, "unmount")) {
+            do_unmount(disk, fs, args, arg1, arg2);
+        } else if (streq(cmd, "sync")) {
+            do_sync(disk, fs, args, arg1, arg2);
         } else if (streq(cmd, "cat")) {
             do_cat(disk, fs, args, arg1, arg2);
         } else if (streq(cmd, "copyout")) {
@@ -87,6 +116,12 @@ int main(int argc, char* argv[]) {
 
             do_touch(fs, arg1);
 
+        } else if (streq(cmd, "mkdir")) {
+            do_mkdir(disk, fs, args, arg1, arg2);
+        } else if (streq(cmd, "lookup")) {
+            do_lookup(disk, fs, args, arg1, arg2);
+        } else if (streq(cmd, "seek")) {
+            do_seek(disk, fs, args, arg1, arg2, arg3);
         } else if (streq(cmd, "help")) {
             do_help(disk, fs, args, arg1, arg2);
         } else if (streq(cmd, "exit") || streq(cmd, "quit")) {
@@ -111,13 +146,31 @@ void do_debug(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
     fs.debug(&disk);
 }
 
-void do_format(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
-    if (args != 1) {
-        printf("Usage: format\n");
+void do_format(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2, char* arg3, char* arg4, char* arg5, char* arg6) {
+    if (args < 1 || args > 7) {
+        printf("Usage: format [blocksize] [extents] [lazy] [journal] [inline] [sparse]\n");
         return;
     }
 
-    if (fs.format(&disk)) {
+    size_t blocksize = 0;
+    uint32_t features = 0;
+    char* options[] = {arg1, arg2, arg3, arg4, arg5, arg6};
+    for (int i = 0; i < args - 1; i++) {
+        if (streq(options[i], "extents"))
+            features |= FileSystem::FEATURE_EXTENTS;
+        else if (streq(options[i], "lazy"))
+            features |= FileSystem::FEATURE_LAZY_INIT;
+        else if (streq(options[i], "journal"))
+            features |= FileSystem::FEATURE_JOURNAL;
+        else if (streq(options[i], "inline"))
+            features |= FileSystem::FEATURE_INLINE;
+        else if (streq(options[i], "sparse"))
+            features |= FileSystem::FEATURE_SPARSE;
+        else
+            blocksize = atoi(options[i]);
+    }
+
+    if (fs.format(&disk, blocksize, features)) {
         printf("disk formatted.\n");
     } else {
         printf("format failed!\n");
@@ -137,6 +190,32 @@ void do_mount(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
     }
 }
 
+void do_unmount(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
+    if (args != 1) {
+        printf("Usage: unmount\n");
+        return;
+    }
+
+    if (fs.unmount()) {
+        printf("disk unmounted.\n");
+    } else {
+        printf("unmount failed!\n");
+    }
+}
+
+void do_sync(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
+    if (args != 1) {
+        printf("Usage: sync\n");
+        return;
+    }
+
+    if (fs.sync()) {
+        printf("disk synced.\n");
+    } else {
+        printf("sync failed!\n");
+    }
+}
+
 void do_cat(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
     if (args != 2) {
         printf("Usage: cat <inode>\n");
@@ -215,8 +294,10 @@ void do_copyin(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
 
 void do_help(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
     printf("Commands are:\n");
-    printf("    format\n");
+    printf("    format  [blocksize] [extents] [lazy] [journal] [inline] [sparse]\n");
     printf("    mount\n");
+    printf("    unmount\n");
+    printf("    sync\n");
     printf("    debug\n");
     printf("    create\n");
     printf("    remove  <inode>\n");
@@ -224,77 +305,178 @@ void do_help(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
     printf("    stat    <inode>\n");
     printf("    copyin  <file> <inode>\n");
     printf("    copyout <inode> <file>\n");
+    printf("    mkdir   <path>\n");
+    printf("    lookup  <path>\n");
+    printf("    seek    <inode> <offset> data|hole\n");
     printf("    help\n");
     printf("    quit\n");
     printf("    exit\n");
 }
 
 bool copyout(FileSystem& fs, size_t inumber, const char* path) {
+    FileHandle* file = fs.open(inumber);
+    if (file == nullptr) {
+        fprintf(stderr, "Unable to open inode %lu\n", inumber);
+        return false;
+    }
+
     FILE* stream = fopen(path, "w");
     if (stream == nullptr) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        fs.close(file);
         return false;
     }
 
+    // so os trechos com dados sao lidos; buracos viram buracos no destino (ou zeros, se nao der seek)
     char buffer[4 * BUFSIZ] = {0};
-    size_t offset = 0;
-    while (true) {
-        ssize_t result = fs.read(inumber, buffer, sizeof(buffer), offset);
-        if (result <= 0) {
+    const ssize_t size = fs.stat(inumber);
+    ssize_t position = 0;
+    bool seekable = true;
+    bool skipped = false;
+    while (position < size) {
+        ssize_t data = file->seek(position, SEEK_DATA);
+        if (data < 0)
+            data = size;
+
+        if (data > position && seekable && fseek(stream, data, SEEK_SET) == 0) {
+            skipped = true;
+        } else if (data > position) {
+            seekable = false;
+            memset(buffer, 0, sizeof(buffer));
+            for (ssize_t left = data - position; left > 0; left -= sizeof(buffer))
+                fwrite(buffer, 1, std::min<size_t>(left, sizeof(buffer)), stream);
+        }
+
+        position = data;
+        if (position >= size)
+            break;
+
+        const ssize_t hole = file->seek(position, SEEK_HOLE);
+        if (hole < 0)
             break;
+
+        file->seek(position);
+        while (position < hole) {
+            ssize_t result = file->read(buffer, std::min<size_t>(hole - position, sizeof(buffer)));
+            if (result <= 0) {
+                break;
+            }
+            fwrite(buffer, 1, result, stream);
+            position += result;
         }
-        fwrite(buffer, 1, result, stream);
-        offset += result;
+
+        if (position < hole)
+            break;
     }
 
-    printf("%lu bytes copied\n", offset);
+    // buraco no fim do arquivo: destino estendido ate o tamanho
+    fflush(stream);
+    if (skipped && position == size && ftruncate(fileno(stream), size) != 0)
+        fprintf(stderr, "Unable to extend %s: %s\n", path, strerror(errno));
+
+    printf("%ld bytes copied\n", position);
     fclose(stream);
+    fs.close(file);
     return true;
 }
 
 bool copyin(FileSystem& fs, const char* path, size_t inumber) {
+    FileHandle* file = fs.open(inumber);
+    if (file == nullptr) {
+        fprintf(stderr, "Unable to open inode %lu\n", inumber);
+        return false;
+    }
+
     FILE* stream = fopen(path, "r");
     if (stream == nullptr) {
         fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        fs.close(file);
         return false;
     }
 
     char buffer[4 * BUFSIZ] = {0};
-    size_t offset = 0;
     while (true) {
         ssize_t result = fread(buffer, 1, sizeof(buffer), stream);
         if (result <= 0) {
             break;
         }
 
-        ssize_t actual = fs.write(inumber, buffer, result, offset);
+        ssize_t actual = file->write(buffer, result);
         if (actual < 0) {
             fprintf(stderr, "fs.write returned invalid result %ld\n", actual);
             break;
         }
-        offset += actual;
         if (actual != result) {
             fprintf(stderr, "fs.write only wrote %ld bytes, not %ld bytes\n", actual, result);
             break;
         }
     }
 
-    printf("%lu bytes copied\n", offset);
+    size_t copied = file->tell();
     fclose(stream);
+
+    // escrita adiada perdida no close: so conta o que chegou aos blocos (copia comeca no offset 0)
+    if (!fs.close(file)) {
+        const ssize_t size = fs.stat(inumber);
+        copied = (size < 0) ? 0 : std::min<size_t>(copied, size);
+        fprintf(stderr, "fs.close failed, only %lu bytes were written\n", copied);
+        return false;
+    }
+
+    printf("%lu bytes copied\n", copied);
     return true;
 }
 
 void do_touch(FileSystem& fs, char* path) {
 
-    char name[FileSystem::NAMESIZE] = {0};
-
-    strcpy(name, path);
-
-    bool ret = fs.touch(name);
+    // nome longo demais e rejeitado pelo fs, nao truncado aqui
+    bool ret = fs.touch(path);
     if (ret) {
         printf("ok\n");
         return;
     }
 
     printf("Falha ao criar arquivo\n");
-}
\ No newline at end of file
+}
+
+void do_mkdir(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
+    if (args != 2) {
+        printf("Usage: mkdir <path>\n");
+        return;
+    }
+
+    ssize_t inumber = fs.mkdir(arg1);
+    if (inumber >= 0) {
+        printf("created directory %s at inode %ld.\n", arg1, inumber);
+    } else {
+        printf("mkdir failed!\n");
+    }
+}
+
+void do_lookup(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2) {
+    if (args != 2) {
+        printf("Usage: lookup <path>\n");
+        return;
+    }
+
+    ssize_t inumber = fs.lookup(arg1);
+    if (inumber >= 0) {
+        printf("%s is inode %ld.\n", arg1, inumber);
+    } else {
+        printf("lookup failed!\n");
+    }
+}
+
+void do_seek(Disk& disk, FileSystem& fs, int args, char* arg1, char* arg2, char* arg3) {
+    if (args != 4 || (!streq(arg3, "data") && !streq(arg3, "hole"))) {
+        printf("Usage: seek <inode> <offset> data|hole\n");
+        return;
+    }
+
+    ssize_t found = fs.seek(atoi(arg1), atol(arg2), streq(arg3, "data") ? SEEK_DATA : SEEK_HOLE);
+    if (found >= 0) {
+        printf("next %s at %ld.\n", arg3, found);
+    } else {
+        printf("seek failed!\n");
+    }
+}
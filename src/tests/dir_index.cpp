@@ -0,0 +1,100 @@
+#include "sfs/fs.hpp"
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Diretorio grande com blocos de 512 bytes (15 entradas por bucket): milhares de divisoes de bucket
+// e o indice crescendo para fora do bloco do cabecalho. Todos os nomes precisam ser achados antes
+// e depois de remontar, duplicatas rejeitadas e nomes ausentes nao encontrados. Sem dentry cache,
+// toda busca passa pelo indice.
+
+static const char* IMAGE = "dir_index.raw";
+static const size_t BLOCKS = 60000;
+static const size_t ENTRIES = 20000;
+
+static void entry_name(char name[FileSystem::NAMESIZE], const char* prefix, size_t i) {
+    memset(name, 0, FileSystem::NAMESIZE);
+    snprintf(name, FileSystem::NAMESIZE, "%s%zu", prefix, i);
+}
+
+static bool fail(const char* what, size_t i) {
+    fprintf(stderr, "dir_index: %s (entry %zu)\n", what, i);
+    return false;
+}
+
+static bool check_lookups(FileSystem& fs) {
+    char name[FileSystem::NAMESIZE];
+    char path[FileSystem::NAMESIZE + 1];
+    std::set<ssize_t> seen;
+
+    for (size_t i = 0; i < ENTRIES; i++) {
+        entry_name(name, "entry_", i);
+        snprintf(path, sizeof(path), "/%s", name);
+        const ssize_t inumber = fs.lookup(path);
+        if (inumber < 0)
+            return fail("name not found", i);
+        if (!seen.insert(inumber).second)
+            return fail("two names share an inode", i);
+    }
+
+    for (size_t i = 0; i < ENTRIES; i += 97) {
+        entry_name(name, "absent_", i);
+        snprintf(path, sizeof(path), "/%s", name);
+        if (fs.lookup(path) >= 0)
+            return fail("absent name found", i);
+    }
+
+    return true;
+}
+
+static bool run() {
+    Disk disk;
+    disk.open(IMAGE, BLOCKS);
+    FileSystem fs(64, BlockCache::Policy::LRU, 1024, 0);
+    if (!fs.format(&disk, 512, FileSystem::FEATURE_LAZY_INIT) || !fs.mount(&disk))
+        return fail("format/mount failed", 0);
+
+    char name[FileSystem::NAMESIZE];
+    for (size_t i = 0; i < ENTRIES; i++) {
+        entry_name(name, "entry_", i);
+        if (!fs.touch(name))
+            return fail("touch failed", i);
+    }
+
+    // duplicatas espalhadas por todo o indice
+    for (size_t i = 0; i < ENTRIES; i += 101) {
+        entry_name(name, "entry_", i);
+        if (fs.touch(name))
+            return fail("duplicate accepted", i);
+    }
+
+    if (!check_lookups(fs))
+        return false;
+
+    if (!fs.unmount() || !fs.mount(&disk))
+        return fail("remount failed", 0);
+
+    if (!check_lookups(fs))
+        return false;
+
+    // indice continua aceitando nomes depois de remontar
+    entry_name(name, "after_", 0);
+    if (!fs.touch(name) || fs.lookup("/after_0") < 0)
+        return fail("insert after remount failed", 0);
+
+    fs.unmount();
+    return true;
+}
+
+int main() {
+    remove(IMAGE);
+    const bool ok = run();
+    remove(IMAGE);
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    printf("dir_index ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+#include "sfs/fs.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Regressao: escrita direta num inode livre (sem create) com FEATURE_LAZY_INIT precisa zerar o bloco
+// de inodes antes; senao um create posterior no mesmo bloco o zera e apaga o arquivo.
+
+static const char* IMAGE = "lazy_init.raw";
+static const size_t BLOCKS = 2000;
+static const size_t INUMBER = 100;
+static const size_t LENGTH = 300000;
+static const int CREATES = 70;
+
+static bool fail(const char* what) {
+    fprintf(stderr, "lazy_init: %s\n", what);
+    return false;
+}
+
+static bool run(const std::vector<char>& data) {
+    Disk disk;
+    disk.open(IMAGE, BLOCKS);
+
+    {
+        FileSystem fs;
+        if (!fs.format(&disk, 4096, FileSystem::FEATURE_LAZY_INIT) || !fs.mount(&disk))
+            return fail("format/mount failed");
+
+        // inode nunca criado, alem dos blocos de inode ja zerados
+        if (fs.write(INUMBER, (char*)data.data(), data.size(), 0) != (ssize_t)data.size())
+            return fail("write failed");
+        if (!fs.unmount() || !fs.mount(&disk))
+            return fail("remount failed");
+
+        // creates ocupam os inodes do mesmo bloco
+        for (int i = 0; i < CREATES; i++) {
+            if (fs.create() < 0)
+                return fail("create failed");
+        }
+        if (!fs.unmount() || !fs.mount(&disk))
+            return fail("second remount failed");
+
+        if (fs.stat(INUMBER) != (ssize_t)data.size())
+            return fail("file size lost");
+
+        std::vector<char> back(data.size());
+        if (fs.read(INUMBER, back.data(), back.size(), 0) != (ssize_t)back.size() || back != data)
+            return fail("file content lost");
+
+        fs.unmount();
+    }
+
+    return true;
+}
+
+int main() {
+    remove(IMAGE);
+
+    std::vector<char> data(LENGTH);
+    srand(1);
+    for (char& c : data)
+        c = (char)rand();
+
+    const bool ok = run(data);
+    remove(IMAGE);
+
+    if (!ok)
+        return EXIT_FAILURE;
+
+    printf("lazy_init ok\n");
+    return EXIT_SUCCESS;
+}